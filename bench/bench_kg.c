@@ -0,0 +1,474 @@
+/* Hot-path benchmarks over a text corpus (see gen_corpus.c), reported as
+   JSON on stdout. Each case runs --repeat times and keeps the fastest;
+   allocations are counted by wrapping malloc and friends at link time
+   (-Wl,--wrap=...), so only calls made by the kg code are seen. */
+#include "../include/kg.h"
+#include "../include/kg_layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+/* Allocation counters. realloc counts as an allocation, so allocs may
+   exceed frees even when nothing leaks. */
+
+static size_t n_allocs, n_frees, alloc_bytes;
+
+void* __real_malloc(size_t n);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t n);
+void __real_free(void* p);
+
+static void counted(size_t n) {
+    __atomic_fetch_add(&n_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&alloc_bytes, n, __ATOMIC_RELAXED);
+}
+
+void* __wrap_malloc(size_t n) { counted(n); return __real_malloc(n); }
+void* __wrap_calloc(size_t n, size_t size) { counted(n * size); return __real_calloc(n, size); }
+void* __wrap_realloc(void* p, size_t n) { counted(n); return __real_realloc(p, n); }
+
+void __wrap_free(void* p) {
+    if (p) __atomic_fetch_add(&n_frees, 1, __ATOMIC_RELAXED);
+    __real_free(p);
+}
+
+/* Peak RSS. Linux lets the high-water mark be reset, giving a per-case
+   peak; elsewhere it is the peak of the whole process so far. */
+
+static void rss_reset(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    if (fd < 0) return;
+    if (write(fd, "5", 1) != 1) { /* not supported: keep the process peak */ }
+    close(fd);
+}
+
+static long rss_peak_kb(void) {
+    FILE* f = fopen("/proc/self/status", "r");
+    char line[256];
+    long kb = -1;
+    while (f && fgets(line, sizeof(line), f))
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1) break;
+    if (f) fclose(f);
+    if (kb < 0) {
+        struct rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+        kb = ru.ru_maxrss;
+    }
+    return kb;
+}
+
+static double now(void) { return kg_clock_ms() * 1e-3; }
+
+/* Cases */
+
+typedef struct {
+    const char* name;
+    const char* unit;       /* what items counts */
+    double items;           /* per run */
+    double seconds;         /* fastest run */
+    size_t allocs, frees, bytes;
+    long peak_kb;
+} Result;
+
+typedef struct {
+    const char* path;
+    char* text;
+    size_t size;
+    const char** tok;       /* tokens of text, split as kg_load_text does */
+    uint32_t* tok_len;
+    size_t n_tok;
+    size_t lines;
+    KGContext kg;           /* the loaded corpus, for print and layout */
+    char snap[4096];        /* kg saved as a snapshot, for appends */
+    char doc[4096];         /* the corpus' first lines, the document appended */
+    size_t doc_tok;
+    unsigned threads;
+    int fr_iterations;
+} Bench;
+
+typedef void (*CaseFn)(Bench* b, Result* r);
+
+static void run_case(Bench* b, const char* name, CaseFn fn, int repeat, Result* r) {
+    memset(r, 0, sizeof(*r));
+    r->name = name;
+    r->seconds = INFINITY;
+    for (int i = 0; i < repeat; ++i) {
+        Result one = { 0 };
+        size_t a0 = n_allocs, f0 = n_frees, b0 = alloc_bytes;
+        rss_reset();
+        double t0 = now();
+        fn(b, &one);
+        double t = now() - t0;
+        r->unit = one.unit;
+        r->items = one.items;
+        r->allocs = n_allocs - a0;
+        r->frees = n_frees - f0;
+        r->bytes = alloc_bytes - b0;
+        r->peak_kb = rss_peak_kb();
+        if (t < r->seconds) r->seconds = t;
+    }
+}
+
+static void bench_intern(Bench* b, Result* r) {
+    KGContext kg;
+    kg_init(&kg);
+    for (size_t i = 0; i < b->n_tok; ++i) kg_intern_n(&kg, b->tok[i], b->tok_len[i]);
+    kg_free(&kg);
+    r->unit = "tokens";
+    r->items = (double)b->n_tok;
+}
+
+/* Replays the loaded corpus' triples into a fresh store. */
+static void add_triples(Bench* b, Result* r, int dedup) {
+    const TripleStore* ts = &b->kg.triples;
+    KGContext kg;
+    kg_init(&kg);
+    kg_set_dedup(&kg, dedup);
+    for (size_t i = 0; i < ts->n; ++i) kg_add(&kg, ts->t[i].s, ts->t[i].p, ts->t[i].o);
+    kg_free(&kg);
+    r->unit = "triples";
+    r->items = (double)ts->n;
+}
+
+static void bench_add(Bench* b, Result* r) { add_triples(b, r, 0); }
+static void bench_add_dedup(Bench* b, Result* r) { add_triples(b, r, 1); }
+
+/* loads > 1 reads the corpus again into the same graph. With window set
+   the first load leaves weighted co-occurrence edges behind, so later
+   parallel loads must fill in weights their chunks do not keep. */
+static void load(Bench* b, Result* r, unsigned window, int loads) {
+    KGContext kg;
+    kg_init(&kg);
+    kg_set_threads(&kg, b->threads);
+    KGCoocParams cp;
+    kg_cooc_defaults(&cp);
+    cp.window = window;
+    kg_set_cooc(&kg, &cp);
+    size_t first = 0;
+    for (int i = 0; i < loads; ++i) {
+        if (kg_load_text(&kg, b->path) != 0) exit(1);
+        if (i == 0) first = kg.triples.n;
+    }
+    EntityID co = kg_lookup(&kg, "co-occurs");
+    if (kg.triples.w)
+        for (size_t i = first; i < kg.triples.n; ++i)
+            if (kg.triples.w[i] != 1 && kg.triples.t[i].p != co) {
+                fprintf(stderr, "kg_load_text: triple %zu reloaded with weight %u\n", i, kg.triples.w[i]);
+                exit(1);
+            }
+    r->unit = "tokens";
+    r->items = (double)b->n_tok * loads;
+    kg_free(&kg);
+}
+
+static void bench_load(Bench* b, Result* r) { load(b, r, 0, 1); }
+static void bench_load_cooc(Bench* b, Result* r) { load(b, r, 5, 1); }
+static void bench_reload_cooc(Bench* b, Result* r) { load(b, r, 5, 2); }
+
+/* A small document appended to a snapshot of the whole corpus through
+   its log; the cost should follow the document, not the graph. */
+static void bench_append(Bench* b, Result* r) {
+    KGContext kg;
+    kg_init(&kg);
+    KGWal* w = kg_wal_open(&kg, b->snap);
+    if (!w || kg_wal_append_text(w, b->doc) != 0 || kg_wal_close(w) != 0) exit(1);
+    kg_free(&kg);
+    r->unit = "tokens";
+    r->items = (double)b->doc_tok;
+}
+
+/* Two documents sharing a sentence appended to a new deduplicated graph,
+   which is then reopened. Neither record carries weights, so replaying
+   the second folds repeats into weights the store does not have yet. The
+   result must match loading both documents in memory. */
+static void bench_append_dedup(Bench* b, Result* r) {
+    static const char* text[2] = { "x y z.\n", "x y z.\nq r.\n" };
+    char path[4200], log[4300], doc[2][4300];
+    snprintf(path, sizeof(path), "%s.dedup.kgs", b->snap);
+    snprintf(log, sizeof(log), "%s.wal", path);
+    remove(path);
+    remove(log);
+    KGContext kg, ref;
+    kg_init(&kg);
+    kg_init(&ref);
+    kg_set_dedup(&kg, 1);
+    kg_set_dedup(&ref, 1);
+    for (int i = 0; i < 2; ++i) {
+        snprintf(doc[i], sizeof(doc[i]), "%s.%d.txt", path, i);
+        FILE* f = fopen(doc[i], "wb");
+        if (!f || fputs(text[i], f) < 0 || fclose(f) != 0) exit(1);
+        KGWal* w = kg_wal_open(&kg, path);
+        if (!w || kg_wal_append_text(w, doc[i]) != 0 || kg_wal_close(w) != 0) exit(1);
+        if (kg_load_text(&ref, doc[i]) != 0) exit(1);
+    }
+    kg_free(&kg);
+    kg_init(&kg);
+    if (kg_open_graph(&kg, path) != 0) exit(1);
+    if (kg.triples.n != ref.triples.n) {
+        fprintf(stderr, "kg_wal: %zu triples after two appends, %zu loaded\n", kg.triples.n, ref.triples.n);
+        exit(1);
+    }
+    kg_free(&kg);
+    kg_free(&ref);
+    remove(path);
+    remove(log);
+    remove(doc[0]);
+    remove(doc[1]);
+    r->unit = "documents";
+    r->items = 2;
+}
+
+/* kg_print writes to stdout, which carries the report: point it at
+   /dev/null for the run. */
+static void bench_print(Bench* b, Result* r) {
+    fflush(stdout);
+    int saved = dup(1), null = open("/dev/null", O_WRONLY);
+    dup2(null, 1);
+    close(null);
+    kg_print(&b->kg);
+    fflush(stdout);
+    dup2(saved, 1);
+    close(saved);
+    r->unit = "triples";
+    r->items = (double)b->kg.triples.n;
+}
+
+static void dump_null(Bench* b, Result* r, int format) {
+    int null = open("/dev/null", O_WRONLY);
+    kg_dump(&b->kg, null, format);
+    close(null);
+    r->unit = "triples";
+    r->items = (double)b->kg.triples.n;
+}
+
+static void bench_dump_nt(Bench* b, Result* r) { dump_null(b, r, KG_DUMP_NT); }
+static void bench_dump_tsv(Bench* b, Result* r) { dump_null(b, r, KG_DUMP_TSV); }
+static void bench_dump_bin(Bench* b, Result* r) { dump_null(b, r, KG_DUMP_BIN); }
+
+/* 2-hop next-to neighbourhoods of corpus words, picked with a fixed
+   stride, until a quarter second is spent. */
+static void bench_khop(Bench* b, Result* r) {
+    EntityID next_to = kg_lookup(&b->kg, "next-to");
+    KGTraverse tv = { &next_to, 1, KG_BOTH, 2 };
+    kg_freeze(&b->kg);
+    int queries = 0;
+    double t0 = now();
+    do {
+        size_t t = (size_t)queries * 7919 % (b->n_tok ? b->n_tok : 1);
+        EntityID src = b->n_tok ? kg_lookup_n(&b->kg, b->tok[t], b->tok_len[t]) : INVALID_ID;
+        KGReach reach;
+        if (kg_khop(&b->kg, src, &tv, &reach) == 0) kg_reach_free(&reach);
+        queries++;
+    } while (now() - t0 < 0.25);
+    r->unit = "queries";
+    r->items = queries;
+}
+
+/* Sentences holding two neighbouring tokens: a three-way join. */
+static void bench_query(Bench* b, Result* r) {
+    kg_predicate_stats(&b->kg);
+    int queries = 0;
+    double t0 = now();
+    do {
+        size_t t = b->n_tok > 1 ? (size_t)queries * 7919 % (b->n_tok - 1) : 0;
+        int la = b->n_tok > 1 && b->tok_len[t] < 64 ? (int)b->tok_len[t] : 0;
+        int lb = la && b->tok_len[t + 1] < 64 ? (int)b->tok_len[t + 1] : 0;
+        char text[256];
+        snprintf(text, sizeof(text), "?s contains \"%.*s\" . ?s contains \"%.*s\" . ?s part-of ?d",
+                 la, la ? b->tok[t] : "", lb, lb ? b->tok[t + 1] : "");
+        KGQuery* q = kg_query(&b->kg, text);
+        while (q && kg_query_next(q)) {}
+        kg_query_free(q);
+        queries++;
+    } while (now() - t0 < 0.25);
+    r->unit = "queries";
+    r->items = queries;
+}
+
+/* Walks of 40 nodes, two from every node, streamed to /dev/null. Edges
+   are followed both ways, so no walk stops early. */
+static void walk_null(Bench* b, Result* r, double p, double q) {
+    KGWalkParams wp;
+    kg_walk_defaults(&wp);
+    wp.length = 40;
+    wp.per_node = 2;
+    wp.p = p;
+    wp.q = q;
+    size_t walks = 0;
+    kg_walk_file(&b->kg, &wp, "/dev/null", &walks);
+    r->unit = "steps";
+    r->items = (double)walks * (wp.length - 1);
+}
+
+static void bench_walk(Bench* b, Result* r) { walk_null(b, r, 1.0, 1.0); }
+static void bench_walk_n2v(Bench* b, Result* r) { walk_null(b, r, 1.0, 0.5); }
+
+/* The placement kg_vis uses, repeated until a quarter second is spent. */
+static void bench_circle(Bench* b, Result* r) {
+    size_t n = b->kg.strings.n;
+    Vec2* pos = malloc((n ? n : 1) * sizeof(Vec2));
+    int iters = 0;
+    double t0 = now();
+    do {
+        for (size_t i = 0; i < n; ++i) {
+            float angle = 2.0f * (float)M_PI * i / n;
+            pos[i].x = 600.0f + 280.0f * cosf(angle);
+            pos[i].y = 400.0f + 280.0f * sinf(angle);
+        }
+        __asm__ volatile("" : : "r"(pos) : "memory");    /* keep the stores */
+        iters++;
+    } while (now() - t0 < 0.25);
+    free(pos);
+    r->unit = "iterations";
+    r->items = iters;
+}
+
+static void bench_fr(Bench* b, Result* r) {
+    LayoutParams lp;
+    kg_layout_defaults(&lp, 1400, 900);
+    lp.iterations = b->fr_iterations;
+    lp.tolerance = 0;
+    lp.threads = b->threads;
+    Vec2* pos = malloc((b->kg.strings.n ? b->kg.strings.n : 1) * sizeof(Vec2));
+    KGLayoutStatus st;
+    kg_layout_fr(&b->kg, &lp, pos, &st);
+    free(pos);
+    r->unit = "iterations";
+    r->items = st.iterations;
+}
+
+/* Corpus */
+
+#define DOC_BYTES (64u << 10)
+
+/* Writes the snapshot and document bench_append uses next to the corpus. */
+static int write_append_files(Bench* b) {
+    snprintf(b->snap, sizeof(b->snap), "%s.append.kgs", b->path);
+    snprintf(b->doc, sizeof(b->doc), "%s.append.txt", b->path);
+    size_t n = b->size < DOC_BYTES ? b->size : DOC_BYTES;
+    while (n > 0 && b->text[n - 1] != '\n') n--;
+    while (b->doc_tok < b->n_tok && b->tok[b->doc_tok] < b->text + n) b->doc_tok++;
+    FILE* f = fopen(b->doc, "wb");
+    if (!f || fwrite(b->text, 1, n, f) != n || fclose(f) != 0) { perror(b->doc); return -1; }
+    return kg_save(&b->kg, b->snap);
+}
+
+static void remove_append_files(Bench* b) {
+    char log[4200];
+    snprintf(log, sizeof(log), "%s.wal", b->snap);
+    remove(b->snap);
+    remove(log);
+    remove(b->doc);
+}
+
+static int read_corpus(Bench* b) {
+    FILE* f = fopen(b->path, "rb");
+    if (!f) { perror(b->path); return -1; }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    b->text = malloc((size_t)size + 1);
+    b->size = fread(b->text, 1, (size_t)size, f);
+    fclose(f);
+
+    // Default delimiters only; the harness does not take --delims.
+    int delim[256] = { 0 };
+    for (const char* d = KG_DEFAULT_DELIMS; *d; ++d) delim[(unsigned char)*d] = 1;
+    size_t cap = 0;
+    for (size_t i = 0; i < b->size; ) {
+        if (b->text[i] == '\n') b->lines++;
+        if (delim[(unsigned char)b->text[i]]) { i++; continue; }
+        size_t j = i;
+        while (j < b->size && !delim[(unsigned char)b->text[j]]) j++;
+        if (b->n_tok == cap) {
+            cap = cap ? cap * 2 : 65536;
+            b->tok = realloc(b->tok, cap * sizeof(*b->tok));
+            b->tok_len = realloc(b->tok_len, cap * sizeof(*b->tok_len));
+        }
+        b->tok[b->n_tok] = b->text + i;
+        b->tok_len[b->n_tok++] = (uint32_t)(j - i);
+        i = j;
+    }
+    return 0;
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s corpus.txt [--threads N] [--repeat N] [--fr-iterations N]\n", prog);
+}
+
+int main(int argc, char** argv) {
+    Bench b = { 0 };
+    int repeat = 3;
+    b.threads = 1;
+    b.fr_iterations = 30;
+    if (argc < 2) { usage(argv[0]); return 1; }
+    b.path = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) b.threads = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--fr-iterations") == 0 && i + 1 < argc) b.fr_iterations = atoi(argv[++i]);
+        else { usage(argv[0]); return 1; }
+    }
+    if (repeat < 1) repeat = 1;
+    if (b.threads < 1) b.threads = 1;
+
+    if (read_corpus(&b) != 0) return 1;
+    kg_init(&b.kg);
+    kg_set_threads(&b.kg, b.threads);
+    if (kg_load_text(&b.kg, b.path) != 0) return 1;
+    if (write_append_files(&b) != 0) return 1;
+
+    static const struct { const char* name; CaseFn fn; } cases[] = {
+        { "kg_intern",      bench_intern },
+        { "kg_add",         bench_add },
+        { "kg_add_dedup",   bench_add_dedup },
+        { "kg_load_text",   bench_load },
+        { "kg_load_cooc",   bench_load_cooc },
+        { "kg_reload_cooc", bench_reload_cooc },
+        { "kg_wal_append",  bench_append },
+        { "kg_wal_dedup",   bench_append_dedup },
+        { "kg_print",       bench_print },
+        { "kg_dump_nt",     bench_dump_nt },
+        { "kg_dump_tsv",    bench_dump_tsv },
+        { "kg_dump_bin",    bench_dump_bin },
+        { "kg_khop",        bench_khop },
+        { "kg_query",       bench_query },
+        { "kg_walk",        bench_walk },
+        { "kg_walk_n2v",    bench_walk_n2v },
+        { "layout_circle",  bench_circle },
+        { "layout_fr",      bench_fr },
+    };
+    enum { N_CASES = sizeof(cases) / sizeof(cases[0]) };
+    Result res[N_CASES];
+    for (int i = 0; i < N_CASES; ++i) {
+        fprintf(stderr, "%-14s ...\n", cases[i].name);
+        run_case(&b, cases[i].name, cases[i].fn, repeat, &res[i]);
+    }
+
+    printf("{\n");
+    printf("  \"corpus\": { \"path\": \"%s\", \"bytes\": %zu, \"lines\": %zu, \"tokens\": %zu,\n",
+           b.path, b.size, b.lines, b.n_tok);
+    printf("              \"entities\": %zu, \"triples\": %zu },\n", b.kg.strings.n, b.kg.triples.n);
+    printf("  \"threads\": %u,\n  \"repeat\": %d,\n  \"kernel\": \"%s\",\n",
+           b.threads, repeat, kg_layout_kernel(NULL));
+    printf("  \"results\": [\n");
+    for (int i = 0; i < N_CASES; ++i) {
+        const Result* r = &res[i];
+        printf("    { \"name\": \"%s\", \"seconds\": %.6f, \"%s\": %.0f, \"%s_per_sec\": %.1f,\n"
+               "      \"allocs\": %zu, \"frees\": %zu, \"alloc_bytes\": %zu, \"peak_rss_kb\": %ld }%s\n",
+               r->name, r->seconds, r->unit, r->items, r->unit, r->items / r->seconds,
+               r->allocs, r->frees, r->bytes, r->peak_kb, i + 1 < N_CASES ? "," : "");
+    }
+    printf("  ]\n}\n");
+
+    remove_append_files(&b);
+    kg_free(&b.kg);
+    free(b.tok);
+    free(b.tok_len);
+    free(b.text);
+    return 0;
+}
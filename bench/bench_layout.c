@@ -0,0 +1,60 @@
+/* Repulsion kernel microbenchmark: pairs per second for every kernel this
+   CPU can run, and each kernel's worst relative error against scalar. */
+#include "../include/kg_layout.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#define N 4096
+
+static double now(void) { return kg_clock_ms() * 1e-3; }
+
+int main(void) {
+    static float x[N], y[N], m[N], ref[N][2];
+    const char* names[] = { "scalar", "avx2", "avx512" };
+    float k2 = 1400.0f * 900.0f / N;
+
+    srand(1);
+    for (int i = 0; i < N; ++i) {
+        x[i] = 80.0f + (float)rand() / RAND_MAX * 1240.0f;
+        y[i] = 80.0f + (float)rand() / RAND_MAX * 740.0f;
+        m[i] = 1.0f + (float)(rand() % 4);
+    }
+
+    printf("%-8s %12s %14s\n", "kernel", "Mpairs/s", "max rel err");
+    for (int k = 0; k < 3; ++k) {
+        if (!kg_layout_kernel(names[k])) {
+            printf("%-8s %12s\n", names[k], "unsupported");
+            continue;
+        }
+
+        double err = 0;
+        for (int i = 0; i < N; ++i) {
+            float f[2] = { 0, 0 };
+            kg_layout_repulse(x, y, m, N, x[i], y[i], k2, f);
+            if (k == 0) {
+                ref[i][0] = f[0];
+                ref[i][1] = f[1];
+            } else {
+                double e = hypot(f[0] - ref[i][0], f[1] - ref[i][1]) / hypot(ref[i][0], ref[i][1]);
+                if (e > err) err = e;
+            }
+        }
+
+        // Whole N x N sweeps until a quarter second has passed.
+        size_t sweeps = 0;
+        float sink = 0;
+        double t0 = now(), t;
+        do {
+            for (int i = 0; i < N; ++i) {
+                float f[2] = { 0, 0 };
+                kg_layout_repulse(x, y, m, N, x[i], y[i], k2, f);
+                sink += f[0];
+            }
+            sweeps++;
+        } while ((t = now() - t0) < 0.25);
+        printf("%-8s %12.1f %14.2e%s\n", names[k], (double)sweeps * N * N / t / 1e6, err,
+               sink == 12345.0f ? " " : "");
+    }
+    return 0;
+}
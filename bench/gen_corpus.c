@@ -0,0 +1,117 @@
+/* Deterministic synthetic corpus: one sentence per line, words drawn from
+   a Zipfian vocabulary. The same options and seed always give the same
+   bytes, so benchmark runs on different machines see the same input. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [--size N[K|M|G]] [--vocab N] [--zipf S] [--words MIN-MAX]\n"
+                    "          [--seed N] [-o FILE]\n"
+                    "Defaults: --size 1M --vocab 100000 --zipf 1.07 --words 4-24 --seed 1, stdout.\n",
+            prog);
+}
+
+static uint64_t splitmix(uint64_t* s) {
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+static double uniform(uint64_t* s) { return (splitmix(s) >> 11) * (1.0 / 9007199254740992.0); }
+
+static int parse_size(const char* s, uint64_t* out) {
+    char* end;
+    double v = strtod(s, &end);
+    if (end == s || v < 0) return -1;
+    switch (*end) {
+    case 'k': case 'K': v *= 1024.0; end++; break;
+    case 'm': case 'M': v *= 1024.0 * 1024.0; end++; break;
+    case 'g': case 'G': v *= 1024.0 * 1024.0 * 1024.0; end++; break;
+    }
+    if (*end) return -1;
+    *out = (uint64_t)v;
+    return 0;
+}
+
+/* Pronounceable word for a rank: consonant-vowel pairs in mixed radix, so
+   every rank gets its own word and frequent words come out short. */
+static size_t word(uint32_t r, char* out) {
+    static const char C[] = "bcdfghjklmnprstvwxyz";
+    static const char V[] = "aeiou";
+    size_t n = 0;
+    do {
+        out[n++] = C[r % 20]; r /= 20;
+        out[n++] = V[r % 5];  r /= 5;
+    } while (r);
+    return n;
+}
+
+int main(int argc, char** argv) {
+    uint64_t size = 1 << 20, seed = 1;
+    uint32_t vocab = 100000, wmin = 4, wmax = 24;
+    double zipf = 1.07;
+    const char* path = NULL;
+
+    for (int i = 1; i < argc; ++i) {
+        int more = i + 1 < argc;
+        if (strcmp(argv[i], "--size") == 0 && more) {
+            if (parse_size(argv[++i], &size) != 0) { usage(argv[0]); return 1; }
+        }
+        else if (strcmp(argv[i], "--vocab") == 0 && more) vocab = (uint32_t)strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--zipf") == 0 && more) zipf = strtod(argv[++i], NULL);
+        else if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--words") == 0 && more) {
+            if (sscanf(argv[++i], "%u-%u", &wmin, &wmax) != 2) { usage(argv[0]); return 1; }
+        }
+        else if (strcmp(argv[i], "-o") == 0 && more) path = argv[++i];
+        else { usage(argv[0]); return 1; }
+    }
+    if (vocab == 0 || wmin == 0 || wmax < wmin) { usage(argv[0]); return 1; }
+
+    FILE* f = path ? fopen(path, "wb") : stdout;
+    if (!f) { perror(path); return 1; }
+
+    // Rank r (0-based) has weight 1 / (r + 1)^zipf.
+    double* cdf = malloc(vocab * sizeof(double));
+    double sum = 0;
+    for (uint32_t r = 0; r < vocab; ++r) {
+        sum += 1.0 / pow(r + 1.0, zipf);
+        cdf[r] = sum;
+    }
+
+    size_t cap = 1 << 20, n = 0;
+    char* buf = malloc(cap + 64);
+    uint64_t written = 0, rng = seed;
+    while (written + n < size) {
+        uint32_t words = wmin + (uint32_t)(splitmix(&rng) % (wmax - wmin + 1));
+        for (uint32_t w = 0; w < words; ++w) {
+            double u = uniform(&rng) * sum;
+            uint32_t lo = 0, hi = vocab - 1;
+            while (lo < hi) {
+                uint32_t mid = lo + (hi - lo) / 2;
+                if (cdf[mid] < u) lo = mid + 1;
+                else hi = mid;
+            }
+            n += word(lo, buf + n);
+            // An occasional comma, as real text has; the loader drops it.
+            if (w + 1 < words && (splitmix(&rng) & 15) == 0) buf[n++] = ',';
+            buf[n++] = w + 1 < words ? ' ' : '.';
+            if (n >= cap) {
+                fwrite(buf, 1, n, f);
+                written += n;
+                n = 0;
+            }
+        }
+        buf[n++] = '\n';
+    }
+    fwrite(buf, 1, n, f);
+
+    free(buf);
+    free(cdf);
+    if (path && fclose(f) != 0) { perror(path); return 1; }
+    return 0;
+}
@@ -8,8 +8,18 @@ typedef uint32_t EntityID;
 #define INVALID_ID 0
 
 typedef struct {
-    char** s;
+    uint32_t hash;
+    EntityID id;            /* INVALID_ID marks an empty slot */
+} StringSlot;
+
+typedef struct {
+    char* pool;             /* NUL-terminated strings stored back to back */
+    size_t pool_n, pool_cap;
+    uint64_t* off;          /* per EntityID-1: byte offset into pool */
+    uint32_t* len;          /* per EntityID-1: length without the NUL */
     size_t n, cap;
+    StringSlot* slots;      /* open-addressed index over the pool, linear probing */
+    size_t slot_cap;        /* power of two, kept at most half full */
 } StringTable;
 
 typedef struct {
@@ -18,20 +28,402 @@ typedef struct {
 
 typedef struct {
     Triple* t;
+    uint32_t* w;            /* per triple occurrence count; NULL means all 1 */
     size_t n, cap;
+    uint32_t* set;          /* dedup index: position + 1 per slot, 0 = empty */
+    size_t set_cap;         /* power of two, kept at most half full */
+    int dedup;              /* kg_add folds repeats into w instead of appending */
+    uint64_t version;       /* bumped by every change, including weight-only ones */
 } TripleStore;
 
+/* Sorted copies of the triple array, one per permutation. */
+typedef struct {
+    Triple* spo;            /* ordered by (s, p, o) */
+    Triple* pos;            /* ordered by (p, o, s) */
+    Triple* osp;            /* ordered by (o, s, p) */
+    size_t n;               /* triples covered */
+    uint64_t version;       /* TripleStore.version this was built from */
+} TripleIndex;
+
+/* Compressed sparse row adjacency. Rows are indexed by EntityID, so row 0
+   is always empty: the out-edges of v are [out_off[v], out_off[v+1]).
+   Within a row, edges are sorted by predicate, then insertion order. */
+typedef struct {
+    size_t n;               /* rows: strings.n + 1 */
+    size_t m;               /* edges: triples covered */
+    uint64_t version;       /* TripleStore.version this was built from */
+    size_t* out_off;        /* n + 1 entries */
+    EntityID* out_nbr;      /* objects */
+    EntityID* out_pred;
+    uint32_t* out_w;        /* edge weights, NULL when the store has none */
+    size_t* in_off;         /* n + 1 entries */
+    EntityID* in_nbr;       /* subjects */
+    EntityID* in_pred;
+    uint32_t* in_w;
+} Adjacency;
+
+/* Per-predicate cardinalities gathered from the sorted index, for query
+   planning. Arrays are indexed by predicate ID, up to n - 1. */
+typedef struct {
+    size_t n;
+    size_t m;               /* triples covered */
+    uint64_t version;       /* TripleStore.version this was built from */
+    size_t* count;          /* triples with predicate p */
+    size_t* subjects;       /* distinct subjects among them */
+    size_t* objects;        /* distinct objects among them */
+    size_t n_subjects, n_objects, n_preds;  /* distinct, over all triples */
+} PredicateStats;
+
+/* Hot-path counters (kg_stats.c). Building with -DKG_NO_STATS compiles
+   every update out, and kg_stats then reports zeros. */
+enum { KG_PHASE_LOAD, KG_PHASE_PARSE, KG_PHASE_MERGE, KG_PHASE_INDEX,
+       KG_PHASE_FREEZE, KG_PHASE_LAYOUT, KG_PHASE_WALK, KG_PHASES };
+
+typedef struct {
+    double phase_ms[KG_PHASES];     /* wall time per phase, summed over calls */
+    uint64_t phase_calls[KG_PHASES];
+    uint64_t interns;       /* kg_intern calls */
+    uint64_t intern_hits;   /* ... that found the string already there */
+    uint64_t probes;        /* hash slots visited by kg_intern */
+    uint64_t rehashes;      /* string and triple hash tables rebuilt */
+    uint64_t grows;         /* array reallocations while appending */
+    uint64_t grow_bytes;    /* bytes those reallocations had to carry over */
+    uint64_t triples_added; /* kg_add calls */
+    uint64_t triples_folded;/* ... merged into an existing triple by dedup */
+    uint64_t cooc_pairs;    /* word pairs counted in co-occurrence windows */
+    uint64_t cooc_edges;    /* co-occurs edges materialized */
+    uint64_t wal_records;   /* documents appended to a write-ahead log */
+    uint64_t wal_bytes;
+    uint64_t wal_syncs;     /* fsyncs of the log */
+    uint64_t compactions;   /* logs folded into their snapshot */
+    uint64_t walks;         /* random walks generated */
+    uint64_t walk_steps;
+    uint64_t walk_rejects;  /* node2vec picks resampled */
+    uint64_t layout_iterations;
+    double layout_energy;   /* sum of squared node forces, last iteration */
+    double layout_step;     /* RMS node step of the last iteration, in pixels */
+} KGStats;
+
+/* Sliding-window co-occurrence for kg_load_text (kg_cooc.c). Pair counts
+   live in a count-min sketch of depth x width counters; a table keeps
+   the `heavy` pairs with the highest estimates. Memory is fixed by these
+   parameters, whatever the corpus size. */
+typedef struct {
+    unsigned window;        /* pair words at most this many tokens apart in a
+                               sentence; 0 turns co-occurrence off */
+    uint32_t threshold;     /* minimum estimated count for a co-occurs edge */
+    size_t width;           /* counters per sketch row, a power of two */
+    unsigned depth;         /* sketch rows */
+    size_t heavy;           /* candidate pairs kept */
+} KGCoocParams;
+
 typedef struct {
     StringTable strings;
     TripleStore triples;
+    TripleIndex index;
+    Adjacency adj;
+    PredicateStats pstats;
+    void* map;              /* read-only snapshot backing strings/triples, or NULL */
+    size_t map_size;
+    uint64_t delims[4];     /* token delimiters for kg_load_text, one bit per byte */
+    unsigned threads;       /* worker threads for kg_load_text */
+    size_t sentences;       /* sentences loaded so far; the next is sentence-(n+1) */
+    KGCoocParams cooc;
+    KGStats stats;
 } KGContext;
 
+/* Contiguous run of index entries matching a pattern. */
+typedef struct {
+    const Triple* cur;
+    const Triple* end;
+} KGIter;
+
+/* Read-only compressed copy of the triple array (kg_pack.c). Triples are
+   sorted by (s, p, o) with repeats folded into weights, then cut into
+   blocks of KG_PACK_BLOCK. Each block stores four bit-packed columns:
+   subject deltas, zigzag predicate deltas, object deltas within a run of
+   equal (s, p) or the raw object otherwise, and weight - 1. */
+#define KG_PACK_BLOCK 128
+
+typedef struct {
+    Triple first;           /* first triple of the block, for seeking */
+    uint32_t bits;          /* column widths, one byte each: s, p, o, w */
+    uint64_t off;           /* start of the block's columns in data */
+} PackBlock;
+
+typedef struct {
+    uint8_t* data;          /* packed columns, padded for 64-bit reads */
+    size_t bytes;
+    PackBlock* blocks;
+    size_t n_blocks;
+    size_t n;               /* distinct triples */
+    int weighted;           /* some weight is not 1 */
+} TriplePack;
+
+typedef struct {
+    const TriplePack* pk;
+    size_t block, end;      /* next block to decode, one past the last */
+    EntityID s;             /* subject filter, or KG_ANY */
+    uint32_t i, n;          /* position in the decoded block */
+    Triple t[KG_PACK_BLOCK];
+    uint32_t w[KG_PACK_BLOCK];
+} KGPackIter;
+
+#define KG_ANY INVALID_ID
+
+/* Default token delimiters shared by every binary. Newlines always end a sentence. */
+#define KG_DEFAULT_DELIMS " \t\r\n.,!?;:'\"()[]"
+
 /* Core API */
 void kg_init(KGContext* ctx);
 EntityID kg_intern(KGContext* ctx, const char* str);
+EntityID kg_intern_n(KGContext* ctx, const char* str, size_t len);
+/* Points into the string pool: valid until the next kg_intern of a new string. */
 const char* kg_str(KGContext* ctx, EntityID id);
 void kg_add(KGContext* ctx, EntityID s, EntityID p, EntityID o);
+void kg_add_weighted(KGContext* ctx, EntityID s, EntityID p, EntityID o, uint32_t w);
+/* Turning dedup on collapses existing repeats into weights (at most 2^32-1
+   distinct triples); turning it off keeps the weights and frees the hash
+   set, e.g. once loading is done. */
+void kg_set_dedup(KGContext* ctx, int on);
+/* Total weight of (s, p, o): its count, or the sum of its weights. */
+uint32_t kg_weight(KGContext* ctx, EntityID s, EntityID p, EntityID o);
+/* Pre-size for at least this many strings, pool bytes and triples in total. */
+void kg_reserve(KGContext* ctx, size_t strings, size_t pool_bytes, size_t triples);
+void kg_print(const KGContext* ctx);
 void kg_free(KGContext* ctx);
+EntityID kg_lookup(const KGContext* ctx, const char* str);
+EntityID kg_lookup_n(const KGContext* ctx, const char* str, size_t len);
+
+/* Text ingestion (kg_text.c). The file is mapped and tokenized in place;
+   only ASCII bytes can be delimiters. With more than one thread, large
+   files are split at line boundaries and loaded in parallel; the result
+   is identical to the serial load. Sentence numbering carries on from
+   earlier loads into the same context or snapshot. */
 int kg_load_text(KGContext* ctx, const char* path);
+void kg_set_delims(KGContext* ctx, const char* delims);
+void kg_set_threads(KGContext* ctx, unsigned threads);
+
+/* Co-occurrence (kg_cooc.c). With cp->window set, kg_load_text counts
+   every pair of distinct words at most window tokens apart within a
+   sentence, and at the end adds (a, co-occurs, b) with a < b, weighted
+   by the estimated count, for each kept pair reaching the threshold.
+   Estimates never undercount. With several threads each chunk sketches
+   on its own and the sketches are summed, so counts match the serial
+   load, though which pairs stay candidates may differ near capacity. */
+typedef struct KGCooc KGCooc;
+
+void kg_cooc_defaults(KGCoocParams* cp);
+void kg_set_cooc(KGContext* ctx, const KGCoocParams* cp);
+size_t kg_cooc_bytes(const KGCoocParams* cp);
+
+/* Used by kg_load_text. Words are keyed by their bytes, so sketches
+   from different contexts can be merged; remap turns from's IDs into
+   to's. */
+KGCooc* kg_cooc_new(const KGCoocParams* cp);
+void kg_cooc_line(KGCooc* cc, const EntityID* ids, const char* const* words, const uint32_t* lens, size_t n);
+void kg_cooc_merge(KGCooc* to, const KGCooc* from, const EntityID* remap);
+void kg_cooc_emit(KGContext* ctx, KGCooc* cc);
+void kg_cooc_free(KGCooc* cc);
+
+/* Pattern lookup (kg_index.c) */
+void kg_index(KGContext* ctx);
+/* Any position may be KG_ANY. Rebuilds the index first if triples were added. */
+KGIter kg_match(KGContext* ctx, EntityID s, EntityID p, EntityID o);
+
+static inline const Triple* kg_next(KGIter* it) {
+    return it->cur < it->end ? it->cur++ : NULL;
+}
+
+static inline size_t kg_count(const KGIter* it) {
+    return (size_t)(it->end - it->cur);
+}
+
+static inline uint32_t kg_weight_at(const KGContext* ctx, size_t i) {
+    return ctx->triples.w ? ctx->triples.w[i] : 1;
+}
+
+/* CSR snapshot (kg_csr.c). Rebuilt only if entities or triples changed. */
+const Adjacency* kg_freeze(KGContext* ctx);
+
+/* Traversal (kg_traverse.c). Breadth-first over the CSR from kg_freeze,
+   switching between top-down and bottom-up steps by frontier size. */
+#define KG_OUT  1           /* follow edges subject -> object */
+#define KG_IN   2           /* follow edges object -> subject */
+#define KG_BOTH 3
+
+typedef struct {
+    const EntityID* preds;  /* follow only these predicates; NULL follows all */
+    size_t n_preds;
+    int dir;                /* KG_OUT, KG_IN or KG_BOTH */
+    int max_hops;           /* negative for no limit */
+} KGTraverse;
+
+/* Entities in BFS order with their hop counts; the start comes first. */
+typedef struct {
+    EntityID* ids;
+    uint32_t* hops;
+    size_t n;
+} KGReach;
+
+/* Everything within tv->max_hops of src; tv NULL follows every edge
+   both ways without limit. Returns -1 if src is not an entity. */
+int kg_khop(KGContext* ctx, EntityID src, const KGTraverse* tv, KGReach* out);
+/* A shortest path from src to dst, both included, with hops 0..n-1.
+   Returns -1 (and an empty path) if there is none within the limit. */
+int kg_path(KGContext* ctx, EntityID src, EntityID dst, const KGTraverse* tv, KGReach* out);
+void kg_reach_free(KGReach* r);
+
+/* Conjunctive queries (kg_query.c). Text form is triple patterns split
+   by " . ", each term a ?variable, a "quoted" string or a bare word:
+       ?s contains ?w . ?w next-to "graph" . ?s part-of document
+   The planner orders patterns greedily by estimated rows, joining each on
+   the variables bound so far by index lookup or, when scanning the
+   pattern once is cheaper, by hash join. Rows stream from kg_query_next
+   and hold one EntityID per variable; the store must not change while a
+   query is open. */
+#define KG_QUERY_VARS 16
+
+typedef struct {
+    EntityID id[3];         /* s, p, o constants, where var is negative */
+    int var[3];             /* variable number, or -1 */
+} KGPattern;
+
+typedef struct KGQuery KGQuery;
+
+/* Returns NULL, with a message on stderr, if the text does not parse. */
+KGQuery* kg_query(KGContext* ctx, const char* text);
+/* Variables are numbered 0..n_vars-1. */
+KGQuery* kg_query_patterns(KGContext* ctx, const KGPattern* pat, size_t n, int n_vars);
+int kg_query_vars(const KGQuery* q);
+/* "?name" from the text form, or "?N". */
+const char* kg_query_var(const KGQuery* q, int var);
+/* Next result row, or NULL once there are no more. */
+const EntityID* kg_query_next(KGQuery* q);
+/* Prints the plan to stderr. */
+void kg_query_explain(const KGQuery* q);
+void kg_query_free(KGQuery* q);
+/* Built on demand and cached until triples change. */
+const PredicateStats* kg_predicate_stats(KGContext* ctx);
+
+/* Random walks (kg_walk.c), DeepWalk or node2vec style, over the CSR
+   from kg_freeze for embedding training. Every entity with an edge to
+   follow starts per_node walks of length nodes; a step picks a neighbour
+   in proportion to edge weight through per-node alias tables, and with
+   p or q other than 1 keeps it with relative odds 1/p for going back, 1
+   for staying next to the previous node and 1/q for moving away. The
+   file is a 24-byte header (magic "KGWALK1", uint64 walks, uint32
+   length, uint32 flags = 0) and then each walk as length uint32
+   EntityIDs, zero past a dead end, in host byte order. Walks are
+   generated with ctx->threads workers; walk i depends only on the seed
+   and i, so the file is the same for any thread count. */
+typedef struct {
+    unsigned length;        /* nodes per walk, the start included */
+    unsigned per_node;      /* walks from each start node */
+    double p, q;            /* node2vec return and in-out parameters */
+    const EntityID* preds;  /* follow only these predicates; NULL follows all */
+    size_t n_preds;
+    int dir;                /* KG_OUT, KG_IN or KG_BOTH */
+    uint64_t seed;
+} KGWalkParams;
+
+void kg_walk_defaults(KGWalkParams* wp);
+/* Returns 0, or -1 with a message on stderr; walks may be NULL. */
+int kg_walk_file(KGContext* ctx, const KGWalkParams* wp, const char* path, size_t* walks);
+
+/* Compressed triples (kg_pack.c). The pack does not track later changes. */
+void kg_pack(const KGContext* ctx, TriplePack* pk);
+void kg_pack_free(TriplePack* pk);
+size_t kg_pack_bytes(const TriplePack* pk);
+/* Iterates every triple of subject s in (p, o) order, or all of them for KG_ANY. */
+void kg_pack_scan(const TriplePack* pk, KGPackIter* it, EntityID s);
+int kg_pack_fill(KGPackIter* it);
+
+static inline const Triple* kg_pack_next(KGPackIter* it) {
+    if (it->i == it->n && !kg_pack_fill(it)) return NULL;
+    return &it->t[it->i++];
+}
+
+/* Weight of the triple kg_pack_next returned last. */
+static inline uint32_t kg_pack_weight(const KGPackIter* it) {
+    return it->w[it->i - 1];
+}
+
+/* Bulk output (kg_dump.c). Text formats are built in large buffers, in
+   parallel over triple ranges with ctx->threads workers, and written in
+   order with writev. TEXT is the kg_print listing; NT is N-Triples with
+   urn:kg: IRIs (weights are dropped); TSV has columns s, p, o, weight
+   with \t \n \r \\ escaped. BIN is the store's arrays as they are, in
+   host byte order: a 40-byte header (magic "KGEDGE1", uint64 n_strings,
+   n_triples, pool_bytes, uint32 flags, pad), uint32 string lengths, the
+   NUL-separated string pool, uint32 (s, p, o) triples, and uint32
+   weights if flags has KG_EDGE_WEIGHTED. */
+enum { KG_DUMP_TEXT, KG_DUMP_NT, KG_DUMP_TSV, KG_DUMP_BIN };
+#define KG_EDGE_WEIGHTED 1u
+
+/* Returns 0, or -1 with errno set if a write failed. */
+int kg_dump(const KGContext* ctx, int fd, int format);
+int kg_dump_file(const KGContext* ctx, const char* path, int format);
+
+/* Statistics (kg_stats.c) */
+void kg_stats(const KGContext* ctx, KGStats* out);
+void kg_stats_reset(KGContext* ctx);
+/* Human-readable report on stderr. */
+void kg_stats_print(const KGStats* s);
+double kg_clock_ms(void);                       /* monotonic, in ms */
+void kg_stats_phase(KGStats* s, int phase, double t0);
+void kg_stats_add(KGStats* to, const KGStats* from);
+
+/* ctx is anything with a KGStats member named stats. */
+#ifdef KG_NO_STATS
+#define KG_STAT(ctx, field, n)      ((void)(ctx))
+#define KG_CLOCK()                  0.0
+#define KG_PHASE(ctx, phase, t0)    ((void)(t0))
+#else
+#define KG_STAT(ctx, field, n)      ((ctx)->stats.field += (n))
+#define KG_CLOCK()                  kg_clock_ms()
+#define KG_PHASE(ctx, phase, t0)    kg_stats_phase(&(ctx)->stats, phase, t0)
+#endif
+
+/* Binary snapshots (kg_snapshot.c). kg_open_mmap expects a freshly
+   initialised context and maps strings and triples read-only; the first
+   kg_add or new kg_intern copies them to the heap via kg_detach. Opening
+   checks only the header, so it reads no data: kg_verify reads it all,
+   checking the data checksum and every offset and ID. */
+int kg_save(const KGContext* ctx, const char* path);
+int kg_open_mmap(KGContext* ctx, const char* path);
+int kg_is_snapshot(const char* path);
+int kg_verify(const char* path);
+void kg_detach(KGContext* ctx);
+/* Identifies the snapshot ctx maps (its header checksum), or 0. */
+uint64_t kg_snapshot_tag(const KGContext* ctx);
+/* The snapshot checksum over n bytes. */
+uint64_t kg_checksum(const void* p, size_t n);
+
+/* Incremental ingestion (kg_wal.c). A graph on disk is a snapshot plus
+   an append-only log beside it, path + ".wal", holding one record per
+   appended document: the strings it added and its triples. Appending
+   parses only the new document and looks its strings up in the mapped
+   snapshot, so it costs time in the document, not the graph. The log is
+   fsynced once 1 MB is unsynced and on kg_wal_sync or close; once it
+   reaches a quarter of the snapshot's size it is compacted into a new
+   snapshot. A torn last record is dropped on the next open. */
+typedef struct KGWal KGWal;
+
+/* Maps the snapshot and replays the log, if any, on top of it. */
+int kg_open_graph(KGContext* ctx, const char* path);
+/* Opens the graph at path for appending, creating an empty one if it
+   does not exist. ctx supplies the load settings (delimiters, threads,
+   dedup) and collects the stats; it is not otherwise touched. Returns
+   NULL, with a message on stderr, on failure. Co-occurrence counts and
+   their threshold span a whole load, which a log of separate documents
+   cannot reproduce, so a ctx with a co-occurrence window is refused. */
+KGWal* kg_wal_open(KGContext* ctx, const char* path);
+int kg_wal_append_text(KGWal* w, const char* path);
+int kg_wal_sync(KGWal* w);
+/* Folds the log into a new snapshot now. */
+int kg_wal_compact(KGWal* w);
+/* Syncs and releases w; returns -1 if the final sync failed. */
+int kg_wal_close(KGWal* w);
 
 #endif
@@ -0,0 +1,69 @@
+#ifndef KG_DRAW_H
+#define KG_DRAW_H
+
+#include "kg.h"
+#include "kg_layout.h"
+#include "kg_export.h"
+#include <SDL2/SDL.h>
+
+/* Batched drawing for the SDL viewers. Edges are one SDL_RenderGeometry
+   call of one-pixel quads, nodes one call of quads textured with a
+   pre-rendered disc, instead of a call per line or per pixel. */
+typedef struct {
+    uint32_t s;             /* source node, 0 when the entry is empty */
+    int32_t x, y;           /* end pixel, or direction and 0 when off screen */
+    int32_t off;
+} KGDrawSeen;
+
+typedef struct {
+    SDL_Renderer* ren;
+    SDL_Texture* disc;      /* white, alpha-edged; tinted per vertex */
+    float radius;
+    SDL_Vertex* vert;       /* 4 per quad, rebuilt each draw */
+    int* index;             /* 6 per quad, fixed */
+    size_t cap;             /* quads the buffers hold */
+    KGDrawSeen* seen;       /* recent (source, end pixel) pairs, to skip overlapping edges */
+} KGDraw;
+
+/* Camera: screen = (world - (x, y)) * scale. Layout positions are
+   window pixels, so { 0, 0, 1 } shows them as laid out. */
+typedef struct {
+    float x, y;
+    float scale;
+} KGView;
+
+/* Uniform grid over node positions, about four nodes per cell, with a
+   pyramid of per-cell counts for the zoomed-out density view. */
+typedef struct {
+    float x0, y0, cell;     /* world corner and side of a level-0 cell */
+    int w, h;               /* level-0 cells */
+    uint32_t* start;        /* cell c holds node[start[c] .. start[c+1]) */
+    uint32_t* node;
+    int levels;
+    uint32_t** count;       /* count[l]: nodes per cell of level l, 2^l cells wide */
+} KGGrid;
+
+/* Scene drawing (kg_draw.c). */
+int kg_draw_init(KGDraw* d, SDL_Renderer* ren, int radius);
+void kg_draw_free(KGDraw* d);
+/* Draws what the view shows of the graph in a sw x sh screen. Only grid
+   cells in view are visited. Edges with a visible end are drawn, except
+   those shorter than a pixel or ending on the same pixel as another
+   edge of the same node. Once a grid cell is smaller than a few
+   pixels on screen, nodes give way to density tiles. */
+void kg_draw_scene(KGDraw* d, const KGView* v, const KGGrid* gr, const Adjacency* g,
+                   const Vec2* pos, int sw, int sh, SDL_Color edge, SDL_Color node);
+
+/* (Re)builds gr for new positions; gr starts zeroed. */
+void kg_grid_build(KGGrid* gr, const Vec2* pos, size_t n);
+void kg_grid_free(KGGrid* gr);
+
+/* Scales by factor about screen point (sx, sy), which stays put. */
+void kg_view_zoom(KGView* v, float sx, float sy, float factor);
+/* Moves the scene by (dx, dy) screen pixels. */
+void kg_view_pan(KGView* v, float dx, float dy);
+/* Wheel zooms about the cursor, left drag pans, 0 resets. Returns 1 if
+   the view changed. */
+int kg_view_event(KGView* v, const SDL_Event* e);
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef KG_EXPORT_H
+#define KG_EXPORT_H
+
+#include "kg.h"
+#include "kg_layout.h"
+#include <math.h>
+
+/* RGB raster, rows top to bottom. */
+typedef struct {
+    int w, h;
+    uint8_t* px;
+} KGImage;
+
+typedef struct { uint8_t r, g, b, a; } KGColor;
+
+/* Brightness of an edge of weight w, shared by the raster and the SDL
+   viewers: dim single edges, full from about 256 repeats up. */
+static inline float kg_edge_shade(uint32_t w) {
+    return fminf(1.0f, 0.45f + 0.07f * log2f((float)w));
+}
+
+/* What a headless viewer run writes; NULL paths are skipped. */
+typedef struct {
+    const char* positions;
+    const char* image;
+    int w, h;               /* image size */
+    float radius;           /* node disc radius */
+    KGColor bg, edge, node;
+} KGExport;
+
+/* Headless output (kg_export.c). */
+/* Positions in EntityID order: CSV ("id,name,x,y", names quoted) when
+   path ends in .csv, otherwise binary in host byte order: the 8 bytes
+   "KGPOS1", a uint64 count, then count float x, y pairs. Returns 0 or -1. */
+int kg_save_positions(KGContext* kg, const Vec2* pos, const char* path);
+
+int kg_image_init(KGImage* img, int w, int h, KGColor bg);
+void kg_image_free(KGImage* img);
+/* Software rasterizer: every out-edge as a line blended at c.a, shaded
+   by weight like the viewers, then every node as a disc of radius r. */
+void kg_image_graph(KGImage* img, const Adjacency* g, const Vec2* pos, size_t n,
+                    KGColor edge, KGColor node, float r);
+/* PNG (uncompressed deflate) when path ends in .png, binary PPM otherwise. */
+int kg_image_save(const KGImage* img, const char* path);
+
+/* Writes the files ex names, reporting the time each took on stderr.
+   Returns 0 or -1. */
+int kg_export(KGContext* kg, const Vec2* pos, const KGExport* ex);
+
+#endif
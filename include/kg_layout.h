@@ -0,0 +1,59 @@
+#ifndef KG_LAYOUT_H
+#define KG_LAYOUT_H
+
+#include "kg.h"
+
+typedef struct { float x, y; } Vec2;
+
+typedef struct {
+    float width, height;    /* layout area, origin top left */
+    float margin;           /* positions are clamped this far inside the area */
+    int iterations;
+    float theta;            /* Barnes-Hut opening angle; 0 selects exact O(n^2) repulsion */
+    unsigned threads;       /* worker threads; the result is the same for any count */
+    int multilevel;         /* coarsen the graph, lay out the coarsest level, then
+                               refine level by level; each level gets up to
+                               iterations steps and the same tolerance */
+    float tolerance;        /* stop early once the RMS node step of an iteration is
+                               below this many pixels; 0 always runs all iterations */
+} LayoutParams;
+
+typedef struct {
+    int iterations;         /* completed so far */
+    float step;             /* RMS node step of the last one, in pixels */
+    int converged;          /* stopped because step fell below the tolerance */
+    int done;               /* the worker has finished */
+} KGLayoutStatus;
+
+typedef struct KGLayout KGLayout;
+
+/* Force-directed layout (kg_layout.c). */
+void kg_layout_defaults(LayoutParams* lp, float width, float height);
+/* Fruchterman-Reingold over the CSR adjacency. pos is indexed by
+   EntityID - 1 and must hold strings.n entries; it is overwritten.
+   st, if not NULL, receives the final status. */
+void kg_layout_fr(KGContext* kg, const LayoutParams* lp, Vec2* pos, KGLayoutStatus* st);
+/* The same layout run on a worker thread. Returns at once with the
+   initial positions published; later positions are published after each
+   iteration. kg must not change until kg_layout_stop. */
+KGLayout* kg_layout_start(KGContext* kg, const LayoutParams* lp);
+/* Newest published positions, held until kg_layout_release; the worker
+   never writes a held buffer. version grows with every publish, so an
+   unchanged one means nothing moved. st.done comes with the final
+   positions, which the worker waits to publish until the reader has
+   released. version and st may be NULL. */
+const Vec2* kg_layout_acquire(KGLayout* run, unsigned* version, KGLayoutStatus* st);
+void kg_layout_release(KGLayout* run);
+/* Cancels the run if it is still going and frees it. */
+void kg_layout_stop(KGLayout* run);
+
+/* Repulsion kernel: "avx512", "avx2", "scalar", or NULL for the fastest
+   this CPU runs. Returns the kernel now selected, or NULL (and keeps the
+   current one) if the requested one cannot run here. */
+const char* kg_layout_kernel(const char* name);
+/* Adds to f the repulsion on (px, py) from n bodies of mass m at (x, y),
+   using the selected kernel. */
+void kg_layout_repulse(const float* x, const float* y, const float* m, size_t n,
+                       float px, float py, float k2, float f[2]);
+
+#endif
@@ -2,122 +2,268 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <stdint.h>
-#include <ctype.h>
 
-typedef uint32_t EntityID;
-#define INVALID_ID 0
+#define MAX_VIA     8       /* --via predicates */
+#define MAX_APPEND  64      /* --append files */
 
+// "?" is a wildcard; a term that was never interned cannot match anything.
+static int match_term(const KGContext* ctx, const char* term, EntityID* out) {
+    if (strcmp(term, "?") == 0) { *out = KG_ANY; return 1; }
+    *out = kg_lookup(ctx, term);
+    return *out != INVALID_ID;
+}
+
+static void print_matches(KGContext* ctx, char** terms) {
+    EntityID s, p, o;
+    if (!match_term(ctx, terms[0], &s) || !match_term(ctx, terms[1], &p) ||
+        !match_term(ctx, terms[2], &o)) {
+        printf("Matches : 0\n");
+        return;
+    }
 
-static void* grow(void* p, size_t es, size_t* cap) {
-    if (*cap == 0) *cap = 64; else *cap *= 2;
-    return realloc(p, es * (*cap));
+    KGIter it = kg_match(ctx, s, p, o);
+    printf("Matches : %zu\n\n", kg_count(&it));
+    for (const Triple* t; (t = kg_next(&it)); )
+        printf("%s --[%s]--> %s\n", kg_str(ctx, t->s), kg_str(ctx, t->p), kg_str(ctx, t->o));
 }
 
-void kg_init(KGContext* ctx) {
-    ctx->strings.s = NULL; ctx->strings.n = ctx->strings.cap = 0;
-    ctx->triples.t = NULL; ctx->triples.n = ctx->triples.cap = 0;
+static int lookup_all(KGContext* ctx, char** terms, int n, EntityID* out) {
+    for (int i = 0; i < n; ++i) {
+        out[i] = kg_lookup(ctx, terms[i]);
+        if (out[i] == INVALID_ID) {
+            fprintf(stderr, "Unknown entity: %s\n", terms[i]);
+            return 0;
+        }
+    }
+    return 1;
 }
 
-EntityID kg_intern(KGContext* ctx, const char* str) {
-    for (size_t i = 0; i < ctx->strings.n; ++i)
-        if (strcmp(ctx->strings.s[i], str) == 0)
-            return (EntityID)(i + 1);
-    if (ctx->strings.n == ctx->strings.cap)
-        ctx->strings.s = grow(ctx->strings.s, sizeof(char*), &ctx->strings.cap);
-    ctx->strings.s[ctx->strings.n] = strdup(str);
-    return ++ctx->strings.n;
+static void print_khop(KGContext* ctx, char* term, int hops, KGTraverse* tv) {
+    EntityID src;
+    KGReach r;
+    tv->max_hops = hops;
+    if (!lookup_all(ctx, &term, 1, &src) || kg_khop(ctx, src, tv, &r) != 0) return;
+    if (hops < 0) printf("Reached : %zu entities\n\n", r.n);
+    else printf("Reached : %zu entities within %d hops\n\n", r.n, hops);
+    for (size_t i = 0; i < r.n; ++i) printf("%u  %s\n", r.hops[i], kg_str(ctx, r.ids[i]));
+    kg_reach_free(&r);
 }
 
-const char* kg_str(KGContext* ctx, EntityID id) {
-    return (id == 0 || id > ctx->strings.n) ? "<invalid>" : ctx->strings.s[id-1];
+static void print_path(KGContext* ctx, char** terms, KGTraverse* tv) {
+    EntityID ends[2];
+    KGReach r;
+    if (!lookup_all(ctx, terms, 2, ends)) return;
+    if (kg_path(ctx, ends[0], ends[1], tv, &r) != 0) {
+        printf("Path    : none\n");
+        return;
+    }
+    printf("Path    : %zu hops\n\n", r.n - 1);
+    for (size_t i = 0; i < r.n; ++i) printf("%s%s", i ? " -> " : "", kg_str(ctx, r.ids[i]));
+    printf("\n");
+    kg_reach_free(&r);
 }
 
-void kg_add(KGContext* ctx, EntityID s, EntityID p, EntityID o) {
-    if (ctx->triples.n == ctx->triples.cap)
-        ctx->triples.t = grow(ctx->triples.t, sizeof(Triple), &ctx->triples.cap);
-    ctx->triples.t[ctx->triples.n++] = (Triple){s, p, o};
+// Rows stream as they are found, so the count comes last.
+static int print_query(KGContext* ctx, const char* text, int explain) {
+    KGQuery* q = kg_query(ctx, text);
+    if (!q) return -1;
+    if (explain) kg_query_explain(q);
+    int n = kg_query_vars(q);
+    for (int v = 0; v < n; ++v) printf("%s%s", v ? "\t" : "", kg_query_var(q, v));
+    printf("\n");
+    size_t rows = 0;
+    for (const EntityID* r; (r = kg_query_next(q)); rows++) {
+        for (int v = 0; v < n; ++v) printf("%s%s", v ? "\t" : "", kg_str(ctx, r[v]));
+        printf("\n");
+    }
+    printf("\nResults : %zu\n", rows);
+    kg_query_free(q);
+    return 0;
 }
 
-void kg_print(const KGContext* ctx) {
+// Same listing as kg_print, decoded from the compressed copy in (s, p, o) order.
+static void print_pack(KGContext* ctx) {
+    TriplePack pk;
+    kg_pack(ctx, &pk);
+    size_t raw = ctx->triples.n * (sizeof(Triple) + (ctx->triples.w ? sizeof(uint32_t) : 0));
+    fprintf(stderr, "Packed  : %zu triples, %zu -> %zu bytes (%.2f B/triple)\n",
+            pk.n, raw, kg_pack_bytes(&pk), pk.n ? (double)kg_pack_bytes(&pk) / pk.n : 0.0);
+
     printf("Knowledge Graph\n");
     printf("Entities: %zu\n", ctx->strings.n);
-    printf("Triples : %zu\n\n", ctx->triples.n);
-    for (size_t i = 0; i < ctx->triples.n; ++i) {
-        Triple t = ctx->triples.t[i];
-
-        printf("%s --[%s]--> %s\n",
-            kg_str((KGContext*)ctx, t.s),
-            kg_str((KGContext*)ctx, t.p),
-            kg_str((KGContext*)ctx, t.o));
+    printf("Triples : %zu\n\n", pk.n);
+    KGPackIter it;
+    kg_pack_scan(&pk, &it, KG_ANY);
+    for (const Triple* t; (t = kg_pack_next(&it)); ) {
+        printf("%s --[%s]--> %s", kg_str(ctx, t->s), kg_str(ctx, t->p), kg_str(ctx, t->o));
+        if (kg_pack_weight(&it) != 1) printf(" (x%u)", kg_pack_weight(&it));
+        printf("\n");
     }
+    kg_pack_free(&pk);
 }
 
-void kg_free(KGContext* ctx) {
-    for (size_t i = 0; i < ctx->strings.n; ++i) free(ctx->strings.s[i]);
-    free(ctx->strings.s); free(ctx->triples.t);
+static int dump_format(const char* name) {
+    static const char* names[] = { "text", "nt", "tsv", "bin" };
+    for (int f = 0; f < 4; ++f)
+        if (strcmp(name, names[f]) == 0) return f;
+    return -1;
 }
 
-int kg_load_text(KGContext* ctx, const char* path) {
-    FILE* f = fopen(path, "r");
-    if (!f) { perror("fopen"); return -1; }
-
-    EntityID doc      = kg_intern(ctx, "document");
-    EntityID contains = kg_intern(ctx, "contains");
-    EntityID next_to  = kg_intern(ctx, "next-to");
-    EntityID part_of  = kg_intern(ctx, "part-of");
-
-    char* line = NULL;
-    size_t len = 0;
-    int sentence_id = 0;
-
-    while (getline(&line, &len, f) != -1) {
-        char* l = line;
-        while (isspace(*l)) l++;
-        if (*l == '\0' || *l == '#') continue;
-
-        sentence_id++;
-        char sent_name[32];
-        snprintf(sent_name, sizeof(sent_name), "sentence-%d", sentence_id);
-        EntityID sentence = kg_intern(ctx, sent_name);
+// Appends each file to the graph at path through its log, creating the graph if needed.
+static int append_files(KGContext* ctx, const char* path, char** files, int n, int compact) {
+    KGWal* w = kg_wal_open(ctx, path);
+    if (!w) return -1;
+    int err = 0;
+    for (int i = 0; i < n && !err; ++i) {
+        printf("Appending text file: %s\n", files[i]);
+        err = kg_wal_append_text(w, files[i]);
+    }
+    if (!err && compact) err = kg_wal_compact(w);
+    if (kg_wal_close(w) != 0) err = -1;
+    if (!err) printf("Updated graph: %s\n", path);
+    return err;
+}
 
-        kg_add(ctx, sentence, part_of, doc);
+static void usage(void) {
+    fprintf(stderr, "Usage: kg text_file.txt|graph.kgs [--delims STR] [--threads N] [--dedup]\n"
+                    "          [--match S P O] [--save graph.kgs] [--pack] [--stats] [--verify]\n"
+                    "          [--dump text|nt|tsv|bin FILE]\n"
+                    "          [--khop TERM K] [--path A B] [--via PRED]... [--directed]\n"
+                    "          [--query \"?s P ?o . ...\"] [--explain] [--cooc N] [--cooc-min T]\n"
+                    "          [--walks FILE] [--walk-length L] [--walks-per-node N]\n"
+                    "          [--walk-p P] [--walk-q Q] [--seed S]\n"
+                    "       kg graph.kgs --append text_file.txt... [--compact] [load options]\n\n");
+}
 
-        char* token = strtok(l, " \t\r\n.,!?;:\n");
-        EntityID prev = 0;
+int main(int argc, char** argv) {
 
-        while (token) {
-            // Skip very short tokens
-            if (strlen(token) < 1) { token = strtok(NULL, " \t\r\n.,!?;:"); continue; }
+    KGContext ctx;
+    kg_init(&ctx);
 
-            EntityID word = kg_intern(ctx, token);
-            kg_add(ctx, sentence, contains, word);
-            if (prev) kg_add(ctx, prev, next_to, word);
-            prev = word;
+    if (argc < 2) { usage(); return 1; }
 
-            token = strtok(NULL, " \t\r\n.,!?;:");
+    char** match = NULL;
+    const char* query = NULL;
+    char** path = NULL;
+    char* khop = NULL;
+    int hops = 0;
+    char* via[MAX_VIA];
+    char* append[MAX_APPEND];
+    int n_append = 0, compact = 0;
+    KGWalkParams wp;
+    kg_walk_defaults(&wp);
+    const char* walks = NULL;
+    KGTraverse tv = { NULL, 0, KG_BOTH, -1 };
+    KGCoocParams cooc;
+    kg_cooc_defaults(&cooc);
+    cooc.window = 0;
+    const char* save = NULL;
+    const char* dump = NULL;
+    int format = -1;
+    int pack = 0, stats = 0, explain = 0, verify = 0;
+    for (int i = 2; i < argc; ++i) {
+        if (strcmp(argv[i], "--match") == 0 && i + 3 < argc) { match = argv + i + 1; i += 3; }
+        else if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) save = argv[++i];
+        else if (strcmp(argv[i], "--delims") == 0 && i + 1 < argc) kg_set_delims(&ctx, argv[++i]);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) kg_set_threads(&ctx, (unsigned)atoi(argv[++i]));
+        else if (strcmp(argv[i], "--dedup") == 0) kg_set_dedup(&ctx, 1);
+        else if (strcmp(argv[i], "--pack") == 0) pack = 1;
+        else if (strcmp(argv[i], "--dump") == 0 && i + 2 < argc && (format = dump_format(argv[i + 1])) >= 0) {
+            dump = argv[i + 2];
+            i += 2;
+        }
+        else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+        else if (strcmp(argv[i], "--verify") == 0) verify = 1;
+        else if (strcmp(argv[i], "--khop") == 0 && i + 2 < argc) { khop = argv[i + 1]; hops = atoi(argv[i + 2]); i += 2; }
+        else if (strcmp(argv[i], "--path") == 0 && i + 2 < argc) { path = argv + i + 1; i += 2; }
+        else if (strcmp(argv[i], "--via") == 0 && i + 1 < argc) {
+            if (tv.n_preds == MAX_VIA) { fprintf(stderr, "kg: at most %d --via predicates\n", MAX_VIA); return 1; }
+            via[tv.n_preds++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "--directed") == 0) tv.dir = KG_OUT;
+        else if (strcmp(argv[i], "--query") == 0 && i + 1 < argc) query = argv[++i];
+        else if (strcmp(argv[i], "--explain") == 0) explain = 1;
+        else if (strcmp(argv[i], "--cooc") == 0 && i + 1 < argc) cooc.window = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cooc-min") == 0 && i + 1 < argc) cooc.threshold = (uint32_t)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--append") == 0 && i + 1 < argc) {
+            if (n_append == MAX_APPEND) { fprintf(stderr, "kg: at most %d --append files\n", MAX_APPEND); return 1; }
+            append[n_append++] = argv[++i];
         }
+        else if (strcmp(argv[i], "--compact") == 0) compact = 1;
+        else if (strcmp(argv[i], "--walks") == 0 && i + 1 < argc) walks = argv[++i];
+        else if (strcmp(argv[i], "--walk-length") == 0 && i + 1 < argc) wp.length = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--walks-per-node") == 0 && i + 1 < argc) wp.per_node = (unsigned)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--walk-p") == 0 && i + 1 < argc) wp.p = atof(argv[++i]);
+        else if (strcmp(argv[i], "--walk-q") == 0 && i + 1 < argc) wp.q = atof(argv[++i]);
+        else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) wp.seed = strtoull(argv[++i], NULL, 10);
+        else { usage(); return 1; }
     }
 
-    free(line);
-    fclose(f);
-    return 0;
-}
+    kg_set_cooc(&ctx, &cooc);
+    if (cooc.window)
+        fprintf(stderr, "Co-occur: window %u, %.1f MB of counters\n", cooc.window, kg_cooc_bytes(&cooc) / 1048576.0);
 
-int main(int argc, char** argv) {
-
-    KGContext ctx;
-    kg_init(&ctx);
+    if (n_append || compact) {
+        int rc = append_files(&ctx, argv[1], append, n_append, compact);
+        if (stats) {
+            KGStats s;
+            kg_stats(&ctx, &s);
+            kg_stats_print(&s);
+        }
+        kg_free(&ctx);
+        return rc ? 1 : 0;
+    }
 
-    if (argc >= 2) {
+    if (kg_is_snapshot(argv[1])) {
+        printf("Opening snapshot: %s\n\n", argv[1]);
+        if (verify && kg_verify(argv[1]) != 0) return 1;
+        if (kg_open_graph(&ctx, argv[1]) != 0) return 1;
+    } else {
         printf("Loading text file: %s\n\n", argv[1]);
         if (kg_load_text(&ctx, argv[1]) != 0) return 1;
-    } else {
-        fprintf(stderr, "Usage: kg text_file.txt\n\n");
-		return 1;
     }
 
-    kg_print(&ctx);
+    if (save) {
+        if (kg_save(&ctx, save) != 0) { kg_free(&ctx); return 1; }
+        printf("Saved snapshot: %s (%zu entities, %zu triples)\n", save, ctx.strings.n, ctx.triples.n);
+    } else if (dump) {
+        if (kg_dump_file(&ctx, dump, format) != 0) { kg_free(&ctx); return 1; }
+        printf("Dumped: %s (%zu triples)\n", dump, ctx.triples.n);
+    } else if (khop || path || walks) {
+        EntityID preds[MAX_VIA];
+        for (size_t k = 0; k < tv.n_preds; ++k) {
+            preds[k] = kg_lookup(&ctx, via[k]);
+            if (preds[k] == INVALID_ID) {
+                fprintf(stderr, "kg: no predicate named \"%s\"\n", via[k]);
+                kg_free(&ctx);
+                return 1;
+            }
+        }
+        if (tv.n_preds) tv.preds = preds;
+        if (walks) {
+            size_t n;
+            wp.preds = tv.preds;
+            wp.n_preds = tv.n_preds;
+            wp.dir = tv.dir;
+            if (kg_walk_file(&ctx, &wp, walks, &n) != 0) { kg_free(&ctx); return 1; }
+            printf("Walks: %s (%zu walks of %u nodes)\n", walks, n, wp.length);
+        }
+        else if (khop) print_khop(&ctx, khop, hops, &tv);
+        else print_path(&ctx, path, &tv);
+    } else if (query) {
+        if (print_query(&ctx, query, explain) != 0) { kg_free(&ctx); return 1; }
+    } else if (match) {
+        print_matches(&ctx, match);
+    } else if (pack) {
+        print_pack(&ctx);
+    } else {
+        kg_print(&ctx);
+    }
+    if (stats) {
+        KGStats s;
+        kg_stats(&ctx, &s);
+        kg_stats_print(&s);
+    }
     kg_free(&ctx);
 
     return 0;
@@ -0,0 +1,241 @@
+#include "../include/kg.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* A pair is keyed by a 64-bit hash of its two words' bytes, smaller word
+   hash first, so the key is the same in every context and either order. */
+typedef struct {
+    uint64_t key;
+    EntityID a, b;
+    uint32_t count;         /* sketch estimate when last offered or pruned */
+} CoocPair;
+
+struct KGCooc {
+    KGCoocParams p;
+    uint32_t* cm;           /* depth rows of width counters */
+    size_t mask;
+    CoocPair* pair;         /* candidates, up to 2 * heavy before pruning */
+    size_t n, cap;
+    uint64_t* slot;         /* open-addressed index: high key half << 32 | pair
+                               position + 1, so misses need not read pair[];
+                               0 = empty */
+    size_t slot_mask;
+    uint32_t floor;         /* estimate a new pair needs to become a candidate */
+    uint64_t counted;
+    uint64_t* h;            /* word hashes of the current line, then pair keys */
+    uint32_t* at;           /* word positions of each pair, two per pair */
+    size_t h_cap;
+};
+
+void kg_cooc_defaults(KGCoocParams* cp) {
+    cp->window = 5;
+    cp->threshold = 5;
+    cp->width = 1u << 20;
+    cp->depth = 4;
+    cp->heavy = 1u << 16;
+}
+
+void kg_set_cooc(KGContext* ctx, const KGCoocParams* cp) {
+    ctx->cooc = *cp;
+}
+
+static size_t pow2_at_least(size_t n) {
+    size_t p = 1;
+    while (p < n) p *= 2;
+    return p;
+}
+
+size_t kg_cooc_bytes(const KGCoocParams* cp) {
+    size_t heavy = cp->heavy ? cp->heavy : 1;
+    return (cp->depth ? cp->depth : 1) * pow2_at_least(cp->width) * sizeof(uint32_t) +
+           2 * heavy * sizeof(CoocPair) + pow2_at_least(4 * heavy) * sizeof(uint64_t);
+}
+
+KGCooc* kg_cooc_new(const KGCoocParams* cp) {
+    KGCooc* cc = calloc(1, sizeof(KGCooc));
+    cc->p = *cp;
+    if (!cc->p.depth) cc->p.depth = 1;
+    if (!cc->p.heavy) cc->p.heavy = 1;
+    size_t width = pow2_at_least(cp->width);
+    cc->mask = width - 1;
+    cc->cm = calloc(cc->p.depth * width, sizeof(uint32_t));
+    cc->cap = 2 * cc->p.heavy;
+    cc->pair = malloc(cc->cap * sizeof(CoocPair));
+    cc->slot_mask = pow2_at_least(2 * cc->cap) - 1;
+    cc->slot = calloc(cc->slot_mask + 1, sizeof(uint64_t));
+    cc->floor = 1;
+    return cc;
+}
+
+void kg_cooc_free(KGCooc* cc) {
+    if (!cc) return;
+    free(cc->cm);
+    free(cc->pair);
+    free(cc->slot);
+    free(cc->h);
+    free(cc->at);
+    free(cc);
+}
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    return x ^ (x >> 33);
+}
+
+static uint64_t hash_word(const char* s, uint32_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (uint32_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return mix64(h);
+}
+
+/* Row r's counter for key, by double hashing from the key's two halves. */
+static inline uint32_t* counter(const KGCooc* cc, uint64_t key, unsigned r) {
+    uint32_t h1 = (uint32_t)key, h2 = (uint32_t)(key >> 32) | 1;
+    return &cc->cm[(size_t)r * (cc->mask + 1) + ((h1 + r * h2) & cc->mask)];
+}
+
+static uint32_t estimate(const KGCooc* cc, uint64_t key) {
+    uint32_t est = UINT32_MAX;
+    for (unsigned r = 0; r < cc->p.depth; ++r) {
+        uint32_t c = *counter(cc, key, r);
+        if (c < est) est = c;
+    }
+    return est;
+}
+
+static inline uint64_t slot_of(uint64_t key, size_t pos) { return (key >> 32) << 32 | (uint64_t)(pos + 1); }
+static inline uint32_t slot_pos(uint64_t e) { return (uint32_t)e; }
+
+static size_t find(const KGCooc* cc, uint64_t key) {
+    size_t j = key & cc->slot_mask;
+    for (uint64_t e; (e = cc->slot[j]); j = (j + 1) & cc->slot_mask)
+        if (e >> 32 == key >> 32 && cc->pair[slot_pos(e) - 1].key == key) break;
+    return j;
+}
+
+static int by_count(const void* x, const void* y) {
+    const CoocPair *a = x, *b = y;
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    return a->key < b->key ? -1 : a->key > b->key;
+}
+
+/* Keeps the heavy pairs with the highest estimates. Anything that cannot
+   beat the weakest of them is not worth a slot until its estimate does. */
+static void prune(KGCooc* cc) {
+    for (size_t i = 0; i < cc->n; ++i) cc->pair[i].count = estimate(cc, cc->pair[i].key);
+    qsort(cc->pair, cc->n, sizeof(CoocPair), by_count);
+    if (cc->n > cc->p.heavy) cc->n = cc->p.heavy;
+    if (cc->n == cc->p.heavy && cc->pair[cc->n - 1].count + 1 > cc->floor)
+        cc->floor = cc->pair[cc->n - 1].count + 1;
+    memset(cc->slot, 0, (cc->slot_mask + 1) * sizeof(uint64_t));
+    for (size_t i = 0; i < cc->n; ++i) cc->slot[find(cc, cc->pair[i].key)] = slot_of(cc->pair[i].key, i);
+}
+
+/* Records key at estimate est: refreshes a candidate or admits a new one. */
+static void offer(KGCooc* cc, uint64_t key, EntityID a, EntityID b, uint32_t est) {
+    size_t j = find(cc, key);
+    if (cc->slot[j]) {
+        CoocPair* e = &cc->pair[slot_pos(cc->slot[j]) - 1];
+        if (est > e->count) e->count = est;
+        return;
+    }
+    if (est < cc->floor) return;
+    if (cc->n == cc->cap) {
+        prune(cc);
+        if (est < cc->floor) return;
+        j = find(cc, key);
+    }
+    cc->pair[cc->n] = (CoocPair){ key, a, b, est };
+    cc->slot[j] = slot_of(key, cc->n++);
+}
+
+/* Keys for a whole line are made first so that each pair's counters can
+   be prefetched a few pairs ahead: the sketch is far larger than cache. */
+#define AHEAD 8
+
+void kg_cooc_line(KGCooc* cc, const EntityID* ids, const char* const* words, const uint32_t* lens, size_t n) {
+    size_t w = cc->p.window < n ? cc->p.window : n;
+    if (n * (w + 1) > cc->h_cap) {
+        cc->h_cap = pow2_at_least(n * (w + 1));
+        cc->h = realloc(cc->h, cc->h_cap * sizeof(uint64_t));
+        cc->at = realloc(cc->at, 2 * cc->h_cap * sizeof(uint32_t));
+    }
+    uint64_t* h = cc->h;
+    uint64_t* key = cc->h + n;
+    for (size_t i = 0; i < n; ++i) h[i] = hash_word(words[i], lens[i]);
+
+    size_t m = 0;
+    for (size_t j = 1; j < n; ++j) {
+        for (size_t i = j > w ? j - w : 0; i < j; ++i) {
+            if (ids[i] == ids[j]) continue;
+            uint64_t hl = h[i] < h[j] ? h[i] : h[j], hh = h[i] < h[j] ? h[j] : h[i];
+            key[m] = mix64(hl * 0x9E3779B97F4A7C15ULL ^ hh);
+            cc->at[2 * m] = (uint32_t)i;
+            cc->at[2 * m + 1] = (uint32_t)j;
+            m++;
+        }
+    }
+
+    for (size_t k = 0; k < m; ++k) {
+        if (k + AHEAD < m)
+            for (unsigned r = 0; r < cc->p.depth; ++r) __builtin_prefetch(counter(cc, key[k + AHEAD], r), 1);
+        uint32_t est = UINT32_MAX;
+        for (unsigned r = 0; r < cc->p.depth; ++r) {
+            uint32_t* c = counter(cc, key[k], r);
+            if (*c != UINT32_MAX) ++*c;
+            if (*c < est) est = *c;
+        }
+        // Candidates are re-estimated when pruned, so one below the floor
+        // is among the weakest anyway and needs no refresh.
+        if (est < cc->floor) continue;
+        size_t i = cc->at[2 * k], j = cc->at[2 * k + 1];
+        int lo = h[i] > h[j];
+        offer(cc, key[k], lo ? ids[j] : ids[i], lo ? ids[i] : ids[j], est);
+    }
+    cc->counted += m;
+}
+
+/* Sketches add up counter by counter. Candidates are re-offered at the
+   merged estimate so far; kg_cooc_emit reads every estimate again. */
+void kg_cooc_merge(KGCooc* to, const KGCooc* from, const EntityID* remap) {
+    size_t cells = to->p.depth * (to->mask + 1);
+    for (size_t i = 0; i < cells; ++i) {
+        uint32_t s = to->cm[i] + from->cm[i];
+        to->cm[i] = s < to->cm[i] ? UINT32_MAX : s;
+    }
+    to->counted += from->counted;
+    for (size_t i = 0; i < from->n; ++i) {
+        const CoocPair* e = &from->pair[i];
+        offer(to, e->key, remap[e->a], remap[e->b], estimate(to, e->key));
+    }
+}
+
+static int by_ids(const void* x, const void* y) {
+    const CoocPair *a = x, *b = y;
+    if (a->a != b->a) return a->a < b->a ? -1 : 1;
+    return a->b < b->b ? -1 : a->b > b->b;
+}
+
+void kg_cooc_emit(KGContext* ctx, KGCooc* cc) {
+    EntityID co = kg_intern_n(ctx, "co-occurs", 9);
+    prune(cc);
+    size_t k = 0;
+    for (size_t i = 0; i < cc->n; ++i) {
+        CoocPair e = cc->pair[i];
+        if (e.count < cc->p.threshold) continue;
+        if (e.a > e.b) { EntityID t = e.a; e.a = e.b; e.b = t; }
+        cc->pair[k++] = e;
+    }
+    qsort(cc->pair, k, sizeof(CoocPair), by_ids);
+    for (size_t i = 0; i < k; ++i) kg_add_weighted(ctx, cc->pair[i].a, co, cc->pair[i].b, cc->pair[i].count);
+    KG_STAT(ctx, cooc_pairs, cc->counted);
+    KG_STAT(ctx, cooc_edges, k);
+    cc->n = 0;
+    memset(cc->slot, 0, (cc->slot_mask + 1) * sizeof(uint64_t));
+}
@@ -0,0 +1,286 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+static void* grow(KGContext* ctx, void* p, size_t es, size_t* cap) {
+    KG_STAT(ctx, grows, 1);
+    KG_STAT(ctx, grow_bytes, es * *cap);
+    if (*cap == 0) *cap = 64; else *cap *= 2;
+    return realloc(p, es * (*cap));
+}
+
+// FNV-1a, folded to 32 bits. Stored per slot so rehashing never touches the strings.
+static uint32_t hash_str(const char* s, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ULL;
+    }
+    return (uint32_t)(h ^ (h >> 32));
+}
+
+static void rehash(StringTable* st, size_t cap) {
+    StringSlot* slots = calloc(cap, sizeof(StringSlot));
+    size_t mask = cap - 1;
+    for (size_t i = 0; i < st->slot_cap; ++i) {
+        StringSlot e = st->slots[i];
+        if (e.id == INVALID_ID) continue;
+        size_t j = e.hash & mask;
+        while (slots[j].id != INVALID_ID) j = (j + 1) & mask;
+        slots[j] = e;
+    }
+    free(st->slots);
+    st->slots = slots;
+    st->slot_cap = cap;
+}
+
+void kg_init(KGContext* ctx) {
+    ctx->strings.pool = NULL; ctx->strings.pool_n = ctx->strings.pool_cap = 0;
+    ctx->strings.off = NULL; ctx->strings.len = NULL;
+    ctx->strings.n = ctx->strings.cap = 0;
+    ctx->strings.slots = NULL; ctx->strings.slot_cap = 0;
+    ctx->triples.t = NULL; ctx->triples.w = NULL; ctx->triples.n = ctx->triples.cap = 0;
+    ctx->triples.set = NULL; ctx->triples.set_cap = 0; ctx->triples.dedup = 0;
+    ctx->triples.version = 0;
+    ctx->index.spo = ctx->index.pos = ctx->index.osp = NULL; ctx->index.n = 0;
+    ctx->index.version = 0;
+    memset(&ctx->adj, 0, sizeof(ctx->adj));
+    memset(&ctx->pstats, 0, sizeof(ctx->pstats));
+    ctx->map = NULL; ctx->map_size = 0;
+    kg_set_delims(ctx, KG_DEFAULT_DELIMS);
+    ctx->threads = 1;
+    ctx->sentences = 0;
+    memset(&ctx->cooc, 0, sizeof(ctx->cooc));
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+EntityID kg_intern(KGContext* ctx, const char* str) {
+    return kg_intern_n(ctx, str, strlen(str));
+}
+
+// Returns the slot holding str, or the empty slot where it would go.
+static size_t probe(const StringTable* st, const char* str, size_t len, uint32_t h) {
+    size_t mask = st->slot_cap - 1;
+    size_t j = h & mask;
+    for (; st->slots[j].id != INVALID_ID; j = (j + 1) & mask) {
+        StringSlot e = st->slots[j];
+        if (e.hash == h && st->len[e.id - 1] == len &&
+            memcmp(st->pool + st->off[e.id - 1], str, len) == 0)
+            break;
+    }
+    return j;
+}
+
+EntityID kg_lookup(const KGContext* ctx, const char* str) {
+    return kg_lookup_n(ctx, str, strlen(str));
+}
+
+EntityID kg_lookup_n(const KGContext* ctx, const char* str, size_t len) {
+    if (ctx->strings.slot_cap == 0) return INVALID_ID;
+    return ctx->strings.slots[probe(&ctx->strings, str, len, hash_str(str, len))].id;
+}
+
+EntityID kg_intern_n(KGContext* ctx, const char* str, size_t len) {
+    StringTable* st = &ctx->strings;
+    KG_STAT(ctx, interns, 1);
+    if (ctx->map) {
+        EntityID id = kg_lookup_n(ctx, str, len);
+        if (id != INVALID_ID) { KG_STAT(ctx, intern_hits, 1); return id; }
+        kg_detach(ctx);
+    }
+    if (2 * (st->n + 1) > st->slot_cap) {
+        KG_STAT(ctx, rehashes, 1);
+        rehash(st, st->slot_cap ? st->slot_cap * 2 : 128);
+    }
+
+    uint32_t h = hash_str(str, len);
+    size_t j = probe(st, str, len, h);
+    KG_STAT(ctx, probes, ((j - h) & (st->slot_cap - 1)) + 1);
+    if (st->slots[j].id != INVALID_ID) { KG_STAT(ctx, intern_hits, 1); return st->slots[j].id; }
+
+    if (st->n == st->cap) {
+        size_t cap = st->cap;
+        st->off = grow(ctx, st->off, sizeof(uint64_t), &cap);
+        st->len = grow(ctx, st->len, sizeof(uint32_t), &st->cap);
+    }
+    while (st->pool_n + len + 1 > st->pool_cap)
+        st->pool = grow(ctx, st->pool, 1, &st->pool_cap);
+    memcpy(st->pool + st->pool_n, str, len);
+    st->pool[st->pool_n + len] = '\0';
+    st->off[st->n] = st->pool_n;
+    st->len[st->n] = (uint32_t)len;
+    st->pool_n += len + 1;
+
+    st->slots[j] = (StringSlot){h, (EntityID)(st->n + 1)};
+    return ++st->n;
+}
+
+void kg_reserve(KGContext* ctx, size_t strings, size_t pool_bytes, size_t triples) {
+    if (ctx->map) kg_detach(ctx);
+    StringTable* st = &ctx->strings;
+    if (strings > st->cap) {
+        st->off = realloc(st->off, strings * sizeof(uint64_t));
+        st->len = realloc(st->len, strings * sizeof(uint32_t));
+        st->cap = strings;
+    }
+    if (pool_bytes > st->pool_cap) {
+        st->pool = realloc(st->pool, pool_bytes);
+        st->pool_cap = pool_bytes;
+    }
+    size_t slots = st->slot_cap ? st->slot_cap : 128;
+    while (2 * strings > slots) slots *= 2;
+    if (slots > st->slot_cap) rehash(st, slots);
+    if (triples > ctx->triples.cap) {
+        ctx->triples.t = realloc(ctx->triples.t, triples * sizeof(Triple));
+        if (ctx->triples.w) ctx->triples.w = realloc(ctx->triples.w, triples * sizeof(uint32_t));
+        ctx->triples.cap = triples;
+    }
+}
+
+const char* kg_str(KGContext* ctx, EntityID id) {
+    return (id == 0 || id > ctx->strings.n) ? "<invalid>" : ctx->strings.pool + ctx->strings.off[id-1];
+}
+
+static uint64_t hash_triple(EntityID s, EntityID p, EntityID o) {
+    uint64_t h = ((uint64_t)s << 32 | o) * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)p * 0xC2B2AE3D27D4EB4FULL;
+    return h ^ (h >> 29);
+}
+
+// Returns the set slot holding (s, p, o), or the empty slot where it would go.
+static size_t find_triple(const TripleStore* ts, EntityID s, EntityID p, EntityID o) {
+    size_t mask = ts->set_cap - 1;
+    size_t j = hash_triple(s, p, o) & mask;
+    for (; ts->set[j]; j = (j + 1) & mask) {
+        Triple t = ts->t[ts->set[j] - 1];
+        if (t.s == s && t.p == p && t.o == o) break;
+    }
+    return j;
+}
+
+static size_t set_cap_for(size_t n) {
+    size_t cap = 1024;
+    while (cap < 2 * n) cap *= 2;
+    return cap;
+}
+
+static void resize_set(TripleStore* ts, size_t cap) {
+    free(ts->set);
+    ts->set = calloc(cap, sizeof(uint32_t));
+    ts->set_cap = cap;
+    for (size_t i = 0; i < ts->n; ++i) {
+        size_t j = find_triple(ts, ts->t[i].s, ts->t[i].p, ts->t[i].o);
+        if (!ts->set[j]) ts->set[j] = (uint32_t)(i + 1);
+    }
+}
+
+static void add_weight(uint32_t* w, uint32_t add) {
+    *w = add > UINT32_MAX - *w ? UINT32_MAX : *w + add;
+}
+
+static void ensure_weights(TripleStore* ts) {
+    if (ts->w) return;
+    ts->w = malloc((ts->cap ? ts->cap : 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < ts->n; ++i) ts->w[i] = 1;
+}
+
+void kg_add(KGContext* ctx, EntityID s, EntityID p, EntityID o) {
+    kg_add_weighted(ctx, s, p, o, 1);
+}
+
+void kg_add_weighted(KGContext* ctx, EntityID s, EntityID p, EntityID o, uint32_t w) {
+    TripleStore* ts = &ctx->triples;
+    if (ctx->map) kg_detach(ctx);
+    ts->version++;
+    KG_STAT(ctx, triples_added, 1);
+    if (ts->dedup) {
+        if (2 * (ts->n + 1) > ts->set_cap) {
+            KG_STAT(ctx, rehashes, 1);
+            resize_set(ts, set_cap_for(ts->n + 1));
+        }
+        size_t j = find_triple(ts, s, p, o);
+        if (ts->set[j]) {
+            KG_STAT(ctx, triples_folded, 1);
+            ensure_weights(ts);
+            add_weight(&ts->w[ts->set[j] - 1], w);
+            return;
+        }
+        ts->set[j] = (uint32_t)(ts->n + 1);
+    }
+    if (ts->n == ts->cap) {
+        size_t cap = ts->cap;
+        if (ts->w) ts->w = grow(ctx, ts->w, sizeof(uint32_t), &cap);
+        ts->t = grow(ctx, ts->t, sizeof(Triple), &ts->cap);
+    }
+    if (w != 1) ensure_weights(ts);
+    if (ts->w) ts->w[ts->n] = w;
+    ts->t[ts->n++] = (Triple){s, p, o};
+}
+
+void kg_set_dedup(KGContext* ctx, int on) {
+    TripleStore* ts = &ctx->triples;
+    ts->dedup = on;
+    if (!on) {
+        free(ts->set);
+        ts->set = NULL;
+        ts->set_cap = 0;
+        return;
+    }
+
+    // Compact in place, keeping each triple at its first occurrence.
+    if (ctx->map) kg_detach(ctx);
+    ts->version++;
+    ensure_weights(ts);
+    free(ts->set);
+    ts->set_cap = set_cap_for(ts->n + 1);
+    ts->set = calloc(ts->set_cap, sizeof(uint32_t));
+    size_t k = 0;
+    for (size_t i = 0; i < ts->n; ++i) {
+        Triple t = ts->t[i];
+        size_t j = find_triple(ts, t.s, t.p, t.o);
+        if (ts->set[j]) { add_weight(&ts->w[ts->set[j] - 1], ts->w[i]); continue; }
+        ts->t[k] = t;
+        ts->w[k] = ts->w[i];
+        ts->set[j] = (uint32_t)++k;
+    }
+    ts->n = k;
+}
+
+uint32_t kg_weight(KGContext* ctx, EntityID s, EntityID p, EntityID o) {
+    TripleStore* ts = &ctx->triples;
+    if (!ts->w) {
+        KGIter it = kg_match(ctx, s, p, o);
+        return (uint32_t)kg_count(&it);
+    }
+    if (ts->dedup) {
+        if (!ts->set) resize_set(ts, set_cap_for(ts->n + 1));
+        size_t j = find_triple(ts, s, p, o);
+        return ts->set[j] ? ts->w[ts->set[j] - 1] : 0;
+    }
+    uint32_t sum = 0;
+    for (size_t i = 0; i < ts->n; ++i)
+        if (ts->t[i].s == s && ts->t[i].p == p && ts->t[i].o == o) add_weight(&sum, ts->w[i]);
+    return sum;
+}
+
+void kg_print(const KGContext* ctx) {
+    fflush(stdout);
+    kg_dump(ctx, STDOUT_FILENO, KG_DUMP_TEXT);
+}
+
+void kg_free(KGContext* ctx) {
+    if (ctx->map) {
+        munmap(ctx->map, ctx->map_size);
+    } else {
+        free(ctx->strings.pool); free(ctx->strings.off); free(ctx->strings.len);
+        free(ctx->strings.slots); free(ctx->triples.t); free(ctx->triples.w);
+    }
+    free(ctx->triples.set);
+    free(ctx->index.spo); free(ctx->index.pos); free(ctx->index.osp);
+    free(ctx->adj.out_off); free(ctx->adj.out_nbr); free(ctx->adj.out_pred); free(ctx->adj.out_w);
+    free(ctx->adj.in_off); free(ctx->adj.in_nbr); free(ctx->adj.in_pred); free(ctx->adj.in_w);
+    free(ctx->pstats.count); free(ctx->pstats.subjects); free(ctx->pstats.objects);
+}
@@ -0,0 +1,64 @@
+#include "../include/kg.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Counting sort of the triple array, visited in `order`, into one
+   direction of the CSR. Rows keep the order of `order`. */
+static void build_rows(const TripleStore* ts, const size_t* order, size_t n, int by_object,
+                       size_t** off, EntityID** nbr, EntityID** pred, uint32_t** w) {
+    size_t m = ts->n;
+    *off  = realloc(*off, (n + 1) * sizeof(size_t));
+    *nbr  = realloc(*nbr, (m ? m : 1) * sizeof(EntityID));
+    *pred = realloc(*pred, (m ? m : 1) * sizeof(EntityID));
+    if (ts->w) {
+        *w = realloc(*w, (m ? m : 1) * sizeof(uint32_t));
+    } else {
+        free(*w);
+        *w = NULL;
+    }
+
+    size_t* o = *off;
+    memset(o, 0, (n + 1) * sizeof(size_t));
+    for (size_t i = 0; i < m; ++i)
+        o[(by_object ? ts->t[i].o : ts->t[i].s) + 1]++;
+    for (size_t v = 0; v < n; ++v)
+        o[v + 1] += o[v];
+
+    size_t* fill = malloc((n ? n : 1) * sizeof(size_t));
+    memcpy(fill, o, n * sizeof(size_t));
+    for (size_t k = 0; k < m; ++k) {
+        size_t i = order[k];
+        Triple t = ts->t[i];
+        size_t e = fill[by_object ? t.o : t.s]++;
+        (*nbr)[e]  = by_object ? t.s : t.o;
+        (*pred)[e] = t.p;
+        if (*w) (*w)[e] = ts->w[i];
+    }
+    free(fill);
+}
+
+const Adjacency* kg_freeze(KGContext* ctx) {
+    Adjacency* g = &ctx->adj;
+    size_t n = ctx->strings.n + 1;
+    if (g->out_off && g->n == n && g->version == ctx->triples.version) return g;
+
+    double t0 = KG_CLOCK();
+    // Triple positions by predicate, stably, so that each row comes out
+    // grouped by predicate and traversals can seek to one.
+    const TripleStore* ts = &ctx->triples;
+    size_t* order = malloc((ts->n ? ts->n : 1) * sizeof(size_t));
+    size_t* at = calloc(n + 1, sizeof(size_t));
+    for (size_t i = 0; i < ts->n; ++i) at[ts->t[i].p + 1]++;
+    for (size_t v = 0; v + 1 < n; ++v) at[v + 1] += at[v];
+    for (size_t i = 0; i < ts->n; ++i) order[at[ts->t[i].p]++] = i;
+    free(at);
+
+    build_rows(ts, order, n, 0, &g->out_off, &g->out_nbr, &g->out_pred, &g->out_w);
+    build_rows(ts, order, n, 1, &g->in_off, &g->in_nbr, &g->in_pred, &g->in_w);
+    free(order);
+    g->n = n;
+    g->m = ctx->triples.n;
+    g->version = ctx->triples.version;
+    KG_PHASE(ctx, KG_PHASE_FREEZE, t0);
+    return g;
+}
@@ -0,0 +1,347 @@
+#include "../include/kg_draw.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if !SDL_VERSION_ATLEAST(2, 0, 18)
+#error "kg_draw needs SDL 2.0.18 or newer for SDL_RenderGeometry"
+#endif
+
+#define LOD_PX 6.0f         /* below this cell size on screen, draw density tiles */
+#define SEEN   65536        /* slots in KGDraw.seen */
+
+int kg_draw_init(KGDraw* d, SDL_Renderer* ren, int radius) {
+    d->ren = ren;
+    d->radius = (float)radius;
+    d->vert = NULL;
+    d->index = NULL;
+    d->cap = 0;
+    d->seen = calloc(SEEN, sizeof(KGDrawSeen));
+
+    // One pixel of coverage falloff at the rim stands in for antialiasing.
+    int size = 2 * radius + 2;
+    Uint8* px = malloc((size_t)size * size * 4);
+    float c = size * 0.5f;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            float dist = hypotf(x + 0.5f - c, y + 0.5f - c);
+            float a = fminf(1.0f, fmaxf(0.0f, radius + 0.5f - dist));
+            Uint8* p = px + 4 * ((size_t)y * size + x);
+            p[0] = p[1] = p[2] = 255;
+            p[3] = (Uint8)(a * 255.0f + 0.5f);
+        }
+    }
+    d->disc = SDL_CreateTexture(ren, SDL_PIXELFORMAT_RGBA32, SDL_TEXTUREACCESS_STATIC, size, size);
+    if (d->disc) {
+        SDL_UpdateTexture(d->disc, NULL, px, size * 4);
+        SDL_SetTextureBlendMode(d->disc, SDL_BLENDMODE_BLEND);
+    }
+    free(px);
+    return d->disc ? 0 : -1;
+}
+
+void kg_draw_free(KGDraw* d) {
+    if (d->disc) SDL_DestroyTexture(d->disc);
+    free(d->vert);
+    free(d->index);
+    free(d->seen);
+    d->seen = NULL;
+    d->disc = NULL;
+    d->vert = NULL;
+    d->index = NULL;
+    d->cap = 0;
+}
+
+static void reserve(KGDraw* d, size_t quads) {
+    if (quads <= d->cap) return;
+    size_t cap = d->cap ? d->cap : 1024;
+    while (cap < quads) cap *= 2;
+    d->vert = realloc(d->vert, cap * 4 * sizeof(SDL_Vertex));
+    d->index = realloc(d->index, cap * 6 * sizeof(int));
+    for (size_t q = d->cap; q < cap; q++) {
+        int v = (int)(4 * q);
+        int* ix = d->index + 6 * q;
+        ix[0] = v;     ix[1] = v + 1; ix[2] = v + 2;
+        ix[3] = v + 2; ix[4] = v + 1; ix[5] = v + 3;
+    }
+    d->cap = cap;
+}
+
+static inline void vertex(SDL_Vertex* v, float x, float y, SDL_Color c, float u, float t) {
+    v->position.x = x;
+    v->position.y = y;
+    v->color = c;
+    v->tex_coord.x = u;
+    v->tex_coord.y = t;
+}
+
+static SDL_Vertex* push_quad(KGDraw* d, size_t* q) {
+    reserve(d, *q + 1);
+    return d->vert + 4 * (*q)++;
+}
+
+static void flush(KGDraw* d, SDL_Texture* tex, size_t q) {
+    if (q) SDL_RenderGeometry(d->ren, tex, d->vert, (int)(4 * q), d->index, (int)(6 * q));
+}
+
+typedef struct {
+    const KGView* v;
+    float x0, y0, x1, y1;   /* world rectangle in view */
+} Frame;
+
+static inline int in_view(const Frame* f, Vec2 p) {
+    return p.x >= f->x0 && p.x < f->x1 && p.y >= f->y0 && p.y < f->y1;
+}
+
+/* Cells of a 2^l grid level that overlap the view, clamped to the grid. */
+static void cell_range(const KGGrid* gr, const Frame* f, int l, int r[4]) {
+    float side = gr->cell * (float)(1 << l);
+    int w = (gr->w + (1 << l) - 1) >> l, h = (gr->h + (1 << l) - 1) >> l;
+    r[0] = (int)fmaxf(0.0f, floorf((f->x0 - gr->x0) / side));
+    r[1] = (int)fmaxf(0.0f, floorf((f->y0 - gr->y0) / side));
+    r[2] = (int)fminf((float)w, floorf((f->x1 - gr->x0) / side) + 1);
+    r[3] = (int)fminf((float)h, floorf((f->y1 - gr->y0) / side) + 1);
+}
+
+/* Edges from node s that cover the same pixels as an earlier one are
+   dropped: same end pixel on screen, or for ends off screen the same
+   direction to within about a pixel at the screen edge. Around an in-view
+   hub most edges repeat. The check is a direct-mapped table cleared for
+   each scene, holding the exact source and quantized end, so a collision
+   only evicts: it never drops an edge that is not a true repeat. */
+static int repeat(KGDraw* d, uint32_t s, float ax, float ay, float bx, float by, int off) {
+    KGDrawSeen key = { s, 0, 0, off };
+    if (off) key.x = (int32_t)floorf(atan2f(by - ay, bx - ax) * 1400.0f);
+    else { key.x = (int32_t)floorf(bx); key.y = (int32_t)floorf(by); }
+    uint32_t h = ((uint32_t)key.x * 0x9E3779B1u ^ (uint32_t)key.y ^ (uint32_t)off << 31) ^ s * 0x85EBCA6Bu;
+    KGDrawSeen* slot = &d->seen[(h ^ h >> 16) & (SEEN - 1)];
+    if (slot->s == s && slot->x == key.x && slot->y == key.y && slot->off == off) return 1;
+    *slot = key;
+    return 0;
+}
+
+static void edge_quad(KGDraw* d, size_t* q, const Frame* f, uint32_t s, Vec2 a, Vec2 b, SDL_Color c) {
+    const KGView* v = f->v;
+    float ax = (a.x - v->x) * v->scale, ay = (a.y - v->y) * v->scale;
+    float bx = (b.x - v->x) * v->scale, by = (b.y - v->y) * v->scale;
+    if (repeat(d, s, ax, ay, bx, by, !in_view(f, b))) return;
+    float dx = bx - ax, dy = by - ay;
+    float len = sqrtf(dx*dx + dy*dy);
+    if (len < 1.0f) return;
+    // Half a pixel either side of the segment.
+    float nx = -dy / len * 0.5f, ny = dx / len * 0.5f;
+    SDL_Vertex* q4 = push_quad(d, q);
+    vertex(&q4[0], ax + nx, ay + ny, c, 0, 0);
+    vertex(&q4[1], ax - nx, ay - ny, c, 0, 0);
+    vertex(&q4[2], bx + nx, by + ny, c, 0, 0);
+    vertex(&q4[3], bx - nx, by - ny, c, 0, 0);
+}
+
+static SDL_Color shade(SDL_Color c, const uint32_t* w, size_t e) {
+    if (w) {
+        float f = kg_edge_shade(w[e]);
+        c.r = (Uint8)(c.r * f);
+        c.g = (Uint8)(c.g * f);
+        c.b = (Uint8)(c.b * f);
+    }
+    return c;
+}
+
+/* Out-edges of every node in view, and in-edges whose source is not in
+   view, so each edge is drawn once. Edges with neither end in view are
+   skipped even if they cross it. With density tiles at pyramid level lod,
+   repeats are judged per tile rather than per node. */
+static void draw_edges(KGDraw* d, const Frame* f, const KGGrid* gr, const Adjacency* g,
+                       const Vec2* pos, int lod, SDL_Color c) {
+    int r[4];
+    size_t q = 0;
+    int lw = lod < 0 ? 0 : (gr->w + (1 << lod) - 1) >> lod;
+    cell_range(gr, f, 0, r);
+    for (int cy = r[1]; cy < r[3]; cy++) {
+        for (int cx = r[0]; cx < r[2]; cx++) {
+            size_t cell = (size_t)cy * gr->w + cx;
+            for (uint32_t i = gr->start[cell]; i < gr->start[cell + 1]; i++) {
+                EntityID s = gr->node[i] + 1;
+                Vec2 a = pos[s - 1];
+                if (!in_view(f, a)) continue;
+                uint32_t src = lod < 0 ? s : (uint32_t)((cy >> lod) * lw + (cx >> lod) + 1);
+                for (size_t e = g->out_off[s]; e < g->out_off[s + 1]; e++) {
+                    if (g->out_nbr[e] == 0) continue;
+                    edge_quad(d, &q, f, src, a, pos[g->out_nbr[e] - 1], shade(c, g->out_w, e));
+                }
+                for (size_t e = g->in_off[s]; e < g->in_off[s + 1]; e++) {
+                    Vec2 b = pos[g->in_nbr[e] - 1];
+                    if (!in_view(f, b)) edge_quad(d, &q, f, src, a, b, shade(c, g->in_w, e));
+                }
+            }
+        }
+    }
+    flush(d, NULL, q);
+}
+
+static void draw_nodes(KGDraw* d, const Frame* f, const KGGrid* gr, const Vec2* pos, SDL_Color c) {
+    const KGView* v = f->v;
+    float h = (d->radius + 1.0f) * fminf(1.0f, v->scale);
+    // Discs poking in from just outside still count.
+    Frame pad = *f;
+    pad.x0 -= h / v->scale; pad.y0 -= h / v->scale;
+    pad.x1 += h / v->scale; pad.y1 += h / v->scale;
+    int r[4];
+    size_t q = 0;
+    cell_range(gr, &pad, 0, r);
+    for (int cy = r[1]; cy < r[3]; cy++) {
+        for (int cx = r[0]; cx < r[2]; cx++) {
+            size_t cell = (size_t)cy * gr->w + cx;
+            for (uint32_t i = gr->start[cell]; i < gr->start[cell + 1]; i++) {
+                Vec2 p = pos[gr->node[i]];
+                if (!in_view(&pad, p)) continue;
+                float x = (p.x - v->x) * v->scale, y = (p.y - v->y) * v->scale;
+                SDL_Vertex* q4 = push_quad(d, &q);
+                vertex(&q4[0], x - h, y - h, c, 0, 0);
+                vertex(&q4[1], x + h, y - h, c, 1, 0);
+                vertex(&q4[2], x - h, y + h, c, 0, 1);
+                vertex(&q4[3], x + h, y + h, c, 1, 1);
+            }
+        }
+    }
+    flush(d, d->disc, q);
+}
+
+/* One untextured quad per non-empty cell of the first pyramid level whose
+   cells are at least LOD_PX wide, opacity growing with the log count. */
+static int lod_level(const KGGrid* gr, const KGView* v) {
+    if (gr->cell * v->scale >= LOD_PX) return -1;
+    int l = 0;
+    while (l + 1 < gr->levels && gr->cell * (float)(1 << l) * v->scale < LOD_PX) l++;
+    return l;
+}
+
+static void draw_density(KGDraw* d, const Frame* f, const KGGrid* gr, int l, SDL_Color c) {
+    const KGView* v = f->v;
+    float side = gr->cell * (float)(1 << l);
+    int w = (gr->w + (1 << l) - 1) >> l;
+    int r[4];
+    size_t q = 0;
+    cell_range(gr, f, l, r);
+    for (int cy = r[1]; cy < r[3]; cy++) {
+        for (int cx = r[0]; cx < r[2]; cx++) {
+            uint32_t n = gr->count[l][(size_t)cy * w + cx];
+            if (!n) continue;
+            SDL_Color t = c;
+            t.a = (Uint8)fminf(255.0f, 64.0f + 48.0f * log2f((float)n));
+            float x = (gr->x0 + cx * side - v->x) * v->scale;
+            float y = (gr->y0 + cy * side - v->y) * v->scale;
+            float s = side * v->scale;
+            SDL_Vertex* q4 = push_quad(d, &q);
+            vertex(&q4[0], x, y, t, 0, 0);
+            vertex(&q4[1], x + s, y, t, 0, 0);
+            vertex(&q4[2], x, y + s, t, 0, 0);
+            vertex(&q4[3], x + s, y + s, t, 0, 0);
+        }
+    }
+    SDL_BlendMode mode;
+    SDL_GetRenderDrawBlendMode(d->ren, &mode);
+    SDL_SetRenderDrawBlendMode(d->ren, SDL_BLENDMODE_BLEND);
+    flush(d, NULL, q);
+    SDL_SetRenderDrawBlendMode(d->ren, mode);
+}
+
+void kg_draw_scene(KGDraw* d, const KGView* v, const KGGrid* gr, const Adjacency* g,
+                   const Vec2* pos, int sw, int sh, SDL_Color edge, SDL_Color node) {
+    if (!gr->w) return;
+    Frame f = { v, v->x, v->y, v->x + sw / v->scale, v->y + sh / v->scale };
+    int lod = lod_level(gr, v);
+    memset(d->seen, 0, SEEN * sizeof(KGDrawSeen));
+    draw_edges(d, &f, gr, g, pos, lod, edge);
+    if (lod >= 0) draw_density(d, &f, gr, lod, node);
+    else draw_nodes(d, &f, gr, pos, node);
+}
+
+void kg_grid_build(KGGrid* gr, const Vec2* pos, size_t n) {
+    float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+    for (size_t i = 0; i < n; i++) {
+        x0 = fminf(x0, pos[i].x); x1 = fmaxf(x1, pos[i].x);
+        y0 = fminf(y0, pos[i].y); y1 = fmaxf(y1, pos[i].y);
+    }
+    if (n == 0) x0 = y0 = x1 = y1 = 0;
+
+    // About four nodes per cell, at most 1024 cells a side.
+    float ext = fmaxf(fmaxf(x1 - x0, y1 - y0), 1.0f);
+    float side = ext / fminf(1024.0f, fmaxf(1.0f, sqrtf((float)n / 4.0f)));
+    int w = (int)((x1 - x0) / side) + 1, h = (int)((y1 - y0) / side) + 1;
+    size_t cells = (size_t)w * h;
+    if (cells != (size_t)gr->w * gr->h || !gr->start) {
+        free(gr->start);
+        gr->start = malloc((cells + 1) * sizeof(uint32_t));
+    }
+    gr->node = realloc(gr->node, (n ? n : 1) * sizeof(uint32_t));
+    gr->x0 = x0;
+    gr->y0 = y0;
+    gr->cell = side;
+    gr->w = w;
+    gr->h = h;
+
+#define CELL_OF(p) ((size_t)(int)(((p).y - y0) / side) * w + (size_t)(int)(((p).x - x0) / side))
+    memset(gr->start, 0, (cells + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) gr->start[CELL_OF(pos[i]) + 1]++;
+    for (size_t c = 0; c < cells; c++) gr->start[c + 1] += gr->start[c];
+    for (size_t i = 0; i < n; i++) gr->node[gr->start[CELL_OF(pos[i])]++] = (uint32_t)i;
+    for (size_t c = cells; c > 0; c--) gr->start[c] = gr->start[c - 1];
+    gr->start[0] = 0;
+#undef CELL_OF
+
+    // Count pyramid: level l + 1 sums 2 x 2 cells of level l.
+    for (int l = 0; l < gr->levels; l++) free(gr->count[l]);
+    free(gr->count);
+    gr->levels = 1;
+    while ((w - 1) >> (gr->levels - 1) || (h - 1) >> (gr->levels - 1)) gr->levels++;
+    gr->count = malloc(gr->levels * sizeof(uint32_t*));
+    gr->count[0] = malloc(cells * sizeof(uint32_t));
+    for (size_t c = 0; c < cells; c++) gr->count[0][c] = gr->start[c + 1] - gr->start[c];
+    for (int l = 1; l < gr->levels; l++) {
+        int pw = (w + (1 << (l - 1)) - 1) >> (l - 1), ph = (h + (1 << (l - 1)) - 1) >> (l - 1);
+        int lw = (pw + 1) / 2, lh = (ph + 1) / 2;
+        uint32_t* up = gr->count[l] = calloc((size_t)lw * lh, sizeof(uint32_t));
+        for (int y = 0; y < ph; y++)
+            for (int x = 0; x < pw; x++)
+                up[(size_t)(y / 2) * lw + x / 2] += gr->count[l - 1][(size_t)y * pw + x];
+    }
+}
+
+void kg_grid_free(KGGrid* gr) {
+    for (int l = 0; l < gr->levels; l++) free(gr->count[l]);
+    free(gr->count);
+    free(gr->start);
+    free(gr->node);
+    memset(gr, 0, sizeof(*gr));
+}
+
+void kg_view_zoom(KGView* v, float sx, float sy, float factor) {
+    float wx = v->x + sx / v->scale, wy = v->y + sy / v->scale;
+    v->scale *= factor;
+    v->x = wx - sx / v->scale;
+    v->y = wy - sy / v->scale;
+}
+
+void kg_view_pan(KGView* v, float dx, float dy) {
+    v->x -= dx / v->scale;
+    v->y -= dy / v->scale;
+}
+
+int kg_view_event(KGView* v, const SDL_Event* e) {
+    if (e->type == SDL_MOUSEWHEEL && e->wheel.y) {
+        int mx, my;
+        SDL_GetMouseState(&mx, &my);
+        kg_view_zoom(v, (float)mx, (float)my, powf(1.25f, (float)e->wheel.y));
+        return 1;
+    }
+    if (e->type == SDL_MOUSEMOTION && (e->motion.state & SDL_BUTTON_LMASK)) {
+        kg_view_pan(v, (float)e->motion.xrel, (float)e->motion.yrel);
+        return 1;
+    }
+    if (e->type == SDL_KEYDOWN && e->key.keysym.sym == SDLK_0) {
+        *v = (KGView){ 0, 0, 1 };
+        return 1;
+    }
+    return 0;
+}
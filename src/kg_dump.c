@@ -0,0 +1,324 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#define CHUNK (1u << 16)    /* triples formatted per buffer */
+#define MAX_IOV 64
+
+static const char EDGE_MAGIC[8] = { 'K', 'G', 'E', 'D', 'G', 'E', '1', 0 };
+
+/* Writes every byte of iov[0..n), resuming after short writes. */
+static int write_iov(int fd, struct iovec* iov, int n) {
+    while (n > 0) {
+        ssize_t r = writev(fd, iov, n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        size_t left = (size_t)r;
+        for (; n > 0 && left >= iov->iov_len; n--, iov++) left -= iov->iov_len;
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + left;
+            iov->iov_len -= left;
+        }
+    }
+    return 0;
+}
+
+static int write_all(int fd, const void* p, size_t n) {
+    struct iovec v = { (void*)p, n };
+    return write_iov(fd, &v, 1);
+}
+
+/* Formatting */
+
+typedef struct {
+    char* p;
+    size_t n, cap;
+} Buf;
+
+static inline char* reserve(Buf* b, size_t more) {
+    if (b->n + more > b->cap) {
+        while (b->n + more > b->cap) b->cap = b->cap ? b->cap * 2 : CHUNK * 64;
+        b->p = realloc(b->p, b->cap);
+    }
+    return b->p + b->n;
+}
+
+static inline char* put(char* d, const char* s, size_t n) {
+    memcpy(d, s, n);
+    return d + n;
+}
+
+static inline char* put_u32(char* d, uint32_t v) {
+    char tmp[10];
+    int k = 0;
+    do { tmp[k++] = (char)('0' + v % 10); v /= 10; } while (v);
+    while (k) *d++ = tmp[--k];
+    return d;
+}
+
+/* String of id, as kg_str gives it. */
+static inline const char* str_of(const KGContext* ctx, EntityID id, size_t* len) {
+    if (id == 0 || id > ctx->strings.n) { *len = 9; return "<invalid>"; }
+    *len = ctx->strings.len[id - 1];
+    return ctx->strings.pool + ctx->strings.off[id - 1];
+}
+
+/* N-Triples needs absolute IRIs: each entity becomes urn:kg: plus its
+   bytes, with everything but unreserved ASCII and UTF-8 percent-encoded. */
+static inline int iri_plain(unsigned char c) {
+    return c >= 0x80 || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static inline int tsv_plain(unsigned char c) {
+    return c != '\t' && c != '\n' && c != '\r' && c != '\\';
+}
+
+/* Both escapers copy plain runs whole; most strings are one run. */
+static char* put_iri(char* d, const char* s, size_t n) {
+    static const char hex[] = "0123456789ABCDEF";
+    d = put(d, "<urn:kg:", 8);
+    for (size_t i = 0; i < n; ) {
+        size_t j = i;
+        while (j < n && iri_plain((unsigned char)s[j])) j++;
+        d = put(d, s + i, j - i);
+        if (j == n) break;
+        unsigned char c = (unsigned char)s[j];
+        *d++ = '%';
+        *d++ = hex[c >> 4];
+        *d++ = hex[c & 15];
+        i = j + 1;
+    }
+    *d++ = '>';
+    return d;
+}
+
+static char* put_tsv(char* d, const char* s, size_t n) {
+    for (size_t i = 0; i < n; ) {
+        size_t j = i;
+        while (j < n && tsv_plain((unsigned char)s[j])) j++;
+        d = put(d, s + i, j - i);
+        if (j == n) break;
+        char c = s[j];
+        *d++ = '\\';
+        *d++ = c == '\t' ? 't' : c == '\n' ? 'n' : c == '\r' ? 'r' : '\\';
+        i = j + 1;
+    }
+    return d;
+}
+
+/* Appends triples [lo, hi) to b. */
+static void format_range(const KGContext* ctx, int format, size_t lo, size_t hi, Buf* b) {
+    const Triple* t = ctx->triples.t;
+    for (size_t i = lo; i < hi; ++i) {
+        size_t ls, lp, lo_;
+        const char* s = str_of(ctx, t[i].s, &ls);
+        const char* p = str_of(ctx, t[i].p, &lp);
+        const char* o = str_of(ctx, t[i].o, &lo_);
+        uint32_t w = kg_weight_at(ctx, i);
+        // Escaping at most triples a string; 64 covers the rest.
+        char* d = reserve(b, 3 * (ls + lp + lo_) + 64);
+        switch (format) {
+        case KG_DUMP_TEXT:
+            d = put(d, s, ls);
+            d = put(d, " --[", 4);
+            d = put(d, p, lp);
+            d = put(d, "]--> ", 5);
+            d = put(d, o, lo_);
+            if (w != 1) {
+                d = put(d, " (x", 3);
+                d = put_u32(d, w);
+                *d++ = ')';
+            }
+            break;
+        case KG_DUMP_NT:
+            d = put_iri(d, s, ls);
+            *d++ = ' ';
+            d = put_iri(d, p, lp);
+            *d++ = ' ';
+            d = put_iri(d, o, lo_);
+            d = put(d, " .", 2);
+            break;
+        case KG_DUMP_TSV:
+            d = put_tsv(d, s, ls);
+            *d++ = '\t';
+            d = put_tsv(d, p, lp);
+            *d++ = '\t';
+            d = put_tsv(d, o, lo_);
+            *d++ = '\t';
+            d = put_u32(d, w);
+            break;
+        }
+        *d++ = '\n';
+        b->n = (size_t)(d - b->p);
+    }
+}
+
+static int dump_serial(const KGContext* ctx, int fd, int format) {
+    Buf b = { 0 };
+    int err = 0;
+    for (size_t lo = 0; lo < ctx->triples.n && !err; lo += CHUNK) {
+        b.n = 0;
+        format_range(ctx, format, lo, lo + CHUNK < ctx->triples.n ? lo + CHUNK : ctx->triples.n, &b);
+        err = write_all(fd, b.p, b.n);
+    }
+    free(b.p);
+    return err;
+}
+
+/* Parallel formatting. Workers claim chunks in order and format each
+   into slot chunk % n_slots; the caller writes finished slots in chunk
+   order. A chunk is only claimed once the one that last used its slot
+   has been written, so at most n_slots buffers exist. */
+typedef struct {
+    Buf buf;
+    int ready;
+} Slot;
+
+typedef struct {
+    const KGContext* ctx;
+    int format;
+    size_t n_chunks;
+    size_t next;            /* next chunk to claim */
+    size_t written;         /* chunks written so far */
+    Slot* slot;
+    size_t n_slots;
+    int stop;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+} Dump;
+
+static void* dump_worker(void* arg) {
+    Dump* D = arg;
+    pthread_mutex_lock(&D->mu);
+    for (;;) {
+        while (!D->stop && D->next < D->n_chunks && D->next - D->written >= D->n_slots)
+            pthread_cond_wait(&D->cv, &D->mu);
+        if (D->stop || D->next == D->n_chunks) break;
+        size_t c = D->next++;
+        Slot* sl = &D->slot[c % D->n_slots];
+        pthread_mutex_unlock(&D->mu);
+
+        size_t lo = c * CHUNK, hi = lo + CHUNK < D->ctx->triples.n ? lo + CHUNK : D->ctx->triples.n;
+        sl->buf.n = 0;
+        format_range(D->ctx, D->format, lo, hi, &sl->buf);
+
+        pthread_mutex_lock(&D->mu);
+        sl->ready = 1;
+        pthread_cond_broadcast(&D->cv);
+    }
+    pthread_mutex_unlock(&D->mu);
+    return NULL;
+}
+
+static int dump_parallel(const KGContext* ctx, int fd, int format, unsigned threads) {
+    Dump D = { .ctx = ctx, .format = format };
+    D.n_chunks = (ctx->triples.n + CHUNK - 1) / CHUNK;
+    D.n_slots = 2 * (size_t)threads < MAX_IOV ? 2 * (size_t)threads : MAX_IOV;
+    D.slot = calloc(D.n_slots, sizeof(Slot));
+    pthread_mutex_init(&D.mu, NULL);
+    pthread_cond_init(&D.cv, NULL);
+
+    pthread_t* tid = malloc(threads * sizeof(pthread_t));
+    unsigned started = 0;
+    while (started < threads && pthread_create(&tid[started], NULL, dump_worker, &D) == 0) started++;
+
+    int err = started ? 0 : dump_serial(ctx, fd, format);
+
+    // Write each run of finished chunks with one writev.
+    struct iovec iov[MAX_IOV];
+    pthread_mutex_lock(&D.mu);
+    while (started && D.written < D.n_chunks && !err) {
+        while (!D.slot[D.written % D.n_slots].ready) pthread_cond_wait(&D.cv, &D.mu);
+        int n = 0;
+        for (size_t c = D.written; c < D.n_chunks && n < (int)D.n_slots; ++c, ++n) {
+            Slot* sl = &D.slot[c % D.n_slots];
+            if (!sl->ready) break;
+            iov[n].iov_base = sl->buf.p;
+            iov[n].iov_len = sl->buf.n;
+        }
+        pthread_mutex_unlock(&D.mu);
+        err = write_iov(fd, iov, n);
+        pthread_mutex_lock(&D.mu);
+        for (int k = 0; k < n; ++k) D.slot[(D.written + k) % D.n_slots].ready = 0;
+        D.written += n;
+        pthread_cond_broadcast(&D.cv);
+    }
+    D.stop = 1;
+    pthread_cond_broadcast(&D.cv);
+    pthread_mutex_unlock(&D.mu);
+
+    for (unsigned i = 0; i < started; ++i) pthread_join(tid[i], NULL);
+    for (size_t i = 0; i < D.n_slots; ++i) free(D.slot[i].buf.p);
+    free(D.slot);
+    free(tid);
+    pthread_mutex_destroy(&D.mu);
+    pthread_cond_destroy(&D.cv);
+    return err ? -1 : 0;
+}
+
+/* The binary edge list is the store's own arrays, written as they are:
+   header, string lengths, string pool, triples, then weights if any. */
+static int dump_binary(const KGContext* ctx, int fd) {
+    const StringTable* st = &ctx->strings;
+    const TripleStore* ts = &ctx->triples;
+    struct {
+        char magic[8];
+        uint64_t n_strings, n_triples, pool_bytes;
+        uint32_t flags, pad;
+    } h;
+    memcpy(h.magic, EDGE_MAGIC, sizeof(h.magic));
+    h.n_strings = st->n;
+    h.n_triples = ts->n;
+    h.pool_bytes = st->pool_n;
+    h.flags = ts->w ? KG_EDGE_WEIGHTED : 0;
+    h.pad = 0;
+
+    struct iovec iov[5] = {
+        { &h, sizeof(h) },
+        { st->len, st->n * sizeof(uint32_t) },
+        { st->pool, st->pool_n },
+        { ts->t, ts->n * sizeof(Triple) },
+        { ts->w, ts->w ? ts->n * sizeof(uint32_t) : 0 },
+    };
+    return write_iov(fd, iov, ts->w ? 5 : 4);
+}
+
+int kg_dump(const KGContext* ctx, int fd, int format) {
+    if (format == KG_DUMP_BIN) return dump_binary(ctx, fd);
+
+    if (format == KG_DUMP_TEXT) {
+        Buf b = { 0 };
+        char* d = reserve(&b, 128);
+        d = put(d, "Knowledge Graph\nEntities: ", 26);
+        d += sprintf(d, "%zu\nTriples : %zu\n\n", ctx->strings.n, ctx->triples.n);
+        b.n = (size_t)(d - b.p);
+        int err = write_all(fd, b.p, b.n);
+        free(b.p);
+        if (err) return -1;
+    }
+
+    // Small graphs are not worth the threads.
+    size_t chunks = (ctx->triples.n + CHUNK - 1) / CHUNK;
+    unsigned threads = ctx->threads;
+    if (threads > chunks) threads = (unsigned)chunks;
+    if (threads <= 1) return dump_serial(ctx, fd, format);
+    return dump_parallel(ctx, fd, format, threads);
+}
+
+int kg_dump_file(const KGContext* ctx, const char* path, int format) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror(path); return -1; }
+    int err = kg_dump(ctx, fd, format);
+    if (err) perror(path);
+    if (close(fd) != 0 && !err) { perror(path); err = -1; }
+    return err;
+}
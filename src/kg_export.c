@@ -0,0 +1,242 @@
+#include "../include/kg_export.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const char MAGIC[8] = "KGPOS1";
+
+static int ends_with(const char* s, const char* suffix) {
+    size_t n = strlen(s), k = strlen(suffix);
+    return n >= k && strcmp(s + n - k, suffix) == 0;
+}
+
+int kg_save_positions(KGContext* kg, const Vec2* pos, const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    size_t n = kg->strings.n;
+    if (ends_with(path, ".csv")) {
+        fputs("id,name,x,y\n", f);
+        for (size_t i = 0; i < n; i++) {
+            fprintf(f, "%zu,\"", i + 1);
+            for (const char* c = kg_str(kg, (EntityID)(i + 1)); *c; c++) {
+                if (*c == '"') fputc('"', f);
+                fputc(*c, f);
+            }
+            fprintf(f, "\",%.3f,%.3f\n", pos[i].x, pos[i].y);
+        }
+    } else {
+        uint64_t count = n;
+        fwrite(MAGIC, 1, sizeof(MAGIC), f);
+        fwrite(&count, sizeof(count), 1, f);
+        fwrite(pos, sizeof(Vec2), n, f);
+    }
+    if (ferror(f) | fclose(f)) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int kg_image_init(KGImage* img, int w, int h, KGColor bg) {
+    img->w = w;
+    img->h = h;
+    img->px = malloc((size_t)w * h * 3);
+    if (!img->px) return -1;
+    for (size_t i = 0; i < (size_t)w * h; i++) {
+        img->px[3 * i] = bg.r;
+        img->px[3 * i + 1] = bg.g;
+        img->px[3 * i + 2] = bg.b;
+    }
+    return 0;
+}
+
+void kg_image_free(KGImage* img) {
+    free(img->px);
+    img->px = NULL;
+}
+
+/* Blends c into pixel (x, y) with coverage a in [0, 255]. */
+static inline void plot(KGImage* img, int x, int y, KGColor c, unsigned a) {
+    if ((unsigned)x >= (unsigned)img->w || (unsigned)y >= (unsigned)img->h) return;
+    uint8_t* p = img->px + 3 * ((size_t)y * img->w + x);
+    p[0] = (uint8_t)((c.r * a + p[0] * (255 - a)) / 255);
+    p[1] = (uint8_t)((c.g * a + p[1] * (255 - a)) / 255);
+    p[2] = (uint8_t)((c.b * a + p[2] * (255 - a)) / 255);
+}
+
+/* Clips to the image with Liang-Barsky, then steps Bresenham-style along
+   the major axis. */
+static void line(KGImage* img, float x0, float y0, float x1, float y1, KGColor c) {
+    float t0 = 0, t1 = 1, dx = x1 - x0, dy = y1 - y0;
+    float p[4] = { -dx, dx, -dy, dy };
+    float q[4] = { x0, img->w - 1 - x0, y0, img->h - 1 - y0 };
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0) {
+            if (q[i] < 0) return;
+        } else {
+            float t = q[i] / p[i];
+            if (p[i] < 0) { if (t > t1) return; if (t > t0) t0 = t; }
+            else          { if (t < t0) return; if (t < t1) t1 = t; }
+        }
+    }
+    float ax = x0 + t0 * dx, ay = y0 + t0 * dy;
+    float steps = fmaxf(fabsf(dx), fabsf(dy)) * (t1 - t0);
+    int n = (int)steps;
+    float sx = n ? (t1 - t0) * dx / steps : 0, sy = n ? (t1 - t0) * dy / steps : 0;
+    for (int i = 0; i <= n; i++)
+        plot(img, (int)(ax + i * sx + 0.5f), (int)(ay + i * sy + 0.5f), c, c.a);
+}
+
+/* Same falloff as the viewers' disc texture: one pixel of coverage at
+   the rim. */
+static void disc(KGImage* img, float cx, float cy, float r, KGColor c) {
+    int x0 = (int)floorf(cx - r - 1), x1 = (int)ceilf(cx + r + 1);
+    int y0 = (int)floorf(cy - r - 1), y1 = (int)ceilf(cy + r + 1);
+    if (x1 < 0 || y1 < 0 || x0 >= img->w || y0 >= img->h) return;
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            float a = fminf(1.0f, fmaxf(0.0f, r + 0.5f - hypotf(x - cx, y - cy)));
+            if (a > 0) plot(img, x, y, c, (unsigned)(a * c.a + 0.5f));
+        }
+    }
+}
+
+void kg_image_graph(KGImage* img, const Adjacency* g, const Vec2* pos, size_t n,
+                    KGColor edge, KGColor node, float r) {
+    for (EntityID s = 1; s < g->n; s++) {
+        Vec2 a = pos[s - 1];
+        for (size_t e = g->out_off[s]; e < g->out_off[s + 1]; e++) {
+            if (g->out_nbr[e] == 0) continue;
+            Vec2 b = pos[g->out_nbr[e] - 1];
+            KGColor c = edge;
+            if (g->out_w) {
+                float f = kg_edge_shade(g->out_w[e]);
+                c.r = (uint8_t)(c.r * f);
+                c.g = (uint8_t)(c.g * f);
+                c.b = (uint8_t)(c.b * f);
+            }
+            line(img, a.x, a.y, b.x, b.y, c);
+        }
+    }
+    for (size_t i = 0; i < n; i++) disc(img, pos[i].x, pos[i].y, r, node);
+}
+
+static uint32_t crc_table[256];
+
+static uint32_t crc32(uint32_t crc, const uint8_t* p, size_t n) {
+    if (!crc_table[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            crc_table[i] = c;
+        }
+    }
+    crc = ~crc;
+    while (n--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void put32(uint8_t* p, uint32_t v) {
+    p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+    p[2] = (uint8_t)(v >> 8);  p[3] = (uint8_t)v;
+}
+
+static void chunk(FILE* f, const char* type, const uint8_t* data, size_t n) {
+    uint8_t hdr[8], crc[4];
+    put32(hdr, (uint32_t)n);
+    memcpy(hdr + 4, type, 4);
+    put32(crc, crc32(crc32(0, hdr + 4, 4), data, n));
+    fwrite(hdr, 1, 8, f);
+    fwrite(data, 1, n, f);
+    fwrite(crc, 1, 4, f);
+}
+
+/* Scanlines with filter 0 in a zlib stream of stored deflate blocks:
+   no compressor needed, and the raster is written only once. */
+static void write_png(FILE* f, const KGImage* img) {
+    static const uint8_t sig[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    fwrite(sig, 1, 8, f);
+
+    uint8_t ihdr[13];
+    put32(ihdr, (uint32_t)img->w);
+    put32(ihdr + 4, (uint32_t)img->h);
+    ihdr[8] = 8;                    /* bit depth */
+    ihdr[9] = 2;                    /* RGB */
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    chunk(f, "IHDR", ihdr, 13);
+
+    size_t row = 1 + 3 * (size_t)img->w, raw = row * img->h;
+    size_t blocks = (raw + 65534) / 65535;
+    size_t n = 2 + raw + 5 * (blocks ? blocks : 1) + 4;
+    uint8_t* z = malloc(n);
+    uint8_t* o = z;
+    *o++ = 0x78;
+    *o++ = 0x01;
+    uint32_t s1 = 1, s2 = 0;
+    size_t left = raw, at = 0;
+    do {
+        size_t len = left < 65535 ? left : 65535;
+        *o++ = left == len;         /* BFINAL on the last block, BTYPE 00 */
+        *o++ = (uint8_t)len;
+        *o++ = (uint8_t)(len >> 8);
+        *o++ = (uint8_t)~len;
+        *o++ = (uint8_t)(~len >> 8);
+        for (size_t i = 0; i < len; i++, at++) {
+            size_t y = at / row, x = at % row;
+            uint8_t b = x ? img->px[y * 3 * (size_t)img->w + x - 1] : 0;
+            *o++ = b;
+            s1 = (s1 + b) % 65521;
+            s2 = (s2 + s1) % 65521;
+        }
+        left -= len;
+    } while (left);
+    put32(o, s2 << 16 | s1);
+    o += 4;
+    chunk(f, "IDAT", z, (size_t)(o - z));
+    free(z);
+    chunk(f, "IEND", NULL, 0);
+}
+
+int kg_image_save(const KGImage* img, const char* path) {
+    FILE* f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+    if (ends_with(path, ".png")) {
+        write_png(f, img);
+    } else {
+        fprintf(f, "P6\n%d %d\n255\n", img->w, img->h);
+        fwrite(img->px, 3, (size_t)img->w * img->h, f);
+    }
+    if (ferror(f) | fclose(f)) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+int kg_export(KGContext* kg, const Vec2* pos, const KGExport* ex) {
+    int rc = 0;
+    if (ex->positions) {
+        double t = kg_clock_ms();
+        rc |= kg_save_positions(kg, pos, ex->positions);
+        fprintf(stderr, "Positions: %9.1f ms  %s\n", kg_clock_ms() - t, ex->positions);
+    }
+    if (ex->image) {
+        double t = kg_clock_ms();
+        KGImage img;
+        if (kg_image_init(&img, ex->w, ex->h, ex->bg) != 0) return -1;
+        kg_image_graph(&img, kg_freeze(kg), pos, kg->strings.n, ex->edge, ex->node, ex->radius);
+        double t2 = kg_clock_ms();
+        rc |= kg_image_save(&img, ex->image);
+        kg_image_free(&img);
+        fprintf(stderr, "Raster   : %9.1f ms\n", t2 - t);
+        fprintf(stderr, "Image    : %9.1f ms  %s\n", kg_clock_ms() - t2, ex->image);
+    }
+    return rc ? -1 : 0;
+}
@@ -0,0 +1,114 @@
+#include "../include/kg.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Sort orders, as field numbers into a Triple: 0 = s, 1 = p, 2 = o. */
+static const int ORDER[3][3] = {
+    {0, 1, 2},      /* SPO */
+    {1, 2, 0},      /* POS */
+    {2, 0, 1},      /* OSP */
+};
+
+static inline EntityID field(const Triple* t, int f) {
+    return f == 0 ? t->s : f == 1 ? t->p : t->o;
+}
+
+/* One stable counting pass over 16 bits of one field. Returns 0 when every
+   triple lands in the same bucket, in which case nothing was moved. */
+static int radix_pass(const Triple* src, Triple* dst, size_t n, int f, int shift, size_t* count) {
+    memset(count, 0, 65536 * sizeof(size_t));
+    for (size_t i = 0; i < n; ++i)
+        count[(field(&src[i], f) >> shift) & 0xFFFF]++;
+    for (size_t b = 0; b < 65536; ++b)
+        if (count[b] == n) return 0;
+
+    size_t sum = 0;
+    for (size_t b = 0; b < 65536; ++b) {
+        size_t c = count[b];
+        count[b] = sum;
+        sum += c;
+    }
+    for (size_t i = 0; i < n; ++i)
+        dst[count[(field(&src[i], f) >> shift) & 0xFFFF]++] = src[i];
+    return 1;
+}
+
+/* LSD radix sort: least significant field first, low half before high half. */
+static void sort_triples(Triple* t, Triple* tmp, size_t n, const int* order, size_t* count) {
+    Triple* src = t;
+    Triple* dst = tmp;
+    for (int k = 2; k >= 0; --k) {
+        for (int shift = 0; shift < 32; shift += 16) {
+            if (radix_pass(src, dst, n, order[k], shift, count)) {
+                Triple* sw = src; src = dst; dst = sw;
+            }
+        }
+    }
+    if (src != t) memcpy(t, src, n * sizeof(Triple));
+}
+
+void kg_index(KGContext* ctx) {
+    double t0 = KG_CLOCK();
+    TripleIndex* ix = &ctx->index;
+    size_t n = ctx->triples.n;
+    Triple** perm[3] = { &ix->spo, &ix->pos, &ix->osp };
+
+    Triple* tmp = malloc((n ? n : 1) * sizeof(Triple));
+    size_t* count = malloc(65536 * sizeof(size_t));
+    for (int k = 0; k < 3; ++k) {
+        *perm[k] = realloc(*perm[k], (n ? n : 1) * sizeof(Triple));
+        memcpy(*perm[k], ctx->triples.t, n * sizeof(Triple));
+        sort_triples(*perm[k], tmp, n, ORDER[k], count);
+    }
+    free(count);
+    free(tmp);
+    ix->n = n;
+    ix->version = ctx->triples.version;
+    KG_PHASE(ctx, KG_PHASE_INDEX, t0);
+}
+
+/* Compare the first `len` fields of t, in `order`, against key. */
+static inline int prefix_cmp(const Triple* t, const int* order, const EntityID* key, int len) {
+    for (int k = 0; k < len; ++k) {
+        EntityID v = field(t, order[k]);
+        if (v != key[k]) return v < key[k] ? -1 : 1;
+    }
+    return 0;
+}
+
+static size_t bound(const Triple* t, size_t n, const int* order, const EntityID* key, int len, int upper) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = prefix_cmp(&t[mid], order, key, len);
+        if (c < 0 || (upper && c == 0)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+KGIter kg_match(KGContext* ctx, EntityID s, EntityID p, EntityID o) {
+    if (ctx->index.version != ctx->triples.version || !ctx->index.spo) kg_index(ctx);
+
+    /* Every pattern is a prefix of one permutation: pick it, then bind. */
+    int perm;
+    if (s != KG_ANY)      perm = (p == KG_ANY && o != KG_ANY) ? 2 : 0;
+    else if (p != KG_ANY) perm = 1;
+    else if (o != KG_ANY) perm = 2;
+    else                  perm = 0;
+
+    const Triple* t = perm == 0 ? ctx->index.spo : perm == 1 ? ctx->index.pos : ctx->index.osp;
+    const int* order = ORDER[perm];
+    EntityID bind[3] = { s, p, o };
+    EntityID key[3];
+    int len = 0;
+    while (len < 3 && bind[order[len]] != KG_ANY) {
+        key[len] = bind[order[len]];
+        len++;
+    }
+
+    size_t n = ctx->index.n;
+    size_t lo = bound(t, n, order, key, len, 0);
+    size_t hi = bound(t + lo, n - lo, order, key, len, 1) + lo;
+    return (KGIter){ t + lo, t + hi };
+}
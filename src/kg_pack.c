@@ -0,0 +1,246 @@
+#include "../include/kg.h"
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    Triple t;
+    uint32_t w;
+} Rec;
+
+static inline EntityID rec_field(const Rec* r, int f) {
+    return f == 0 ? r->t.s : f == 1 ? r->t.p : r->t.o;
+}
+
+/* LSD radix sort by (s, p, o) over 16-bit digits, skipping digits that
+   put every record in one bucket. Same scheme as kg_index, but the
+   weight travels with its triple. */
+static Rec* sort_recs(Rec* a, Rec* b, size_t n) {
+    size_t* count = malloc(65536 * sizeof(size_t));
+    for (int f = 2; f >= 0; --f) {
+        for (int shift = 0; shift < 32; shift += 16) {
+            memset(count, 0, 65536 * sizeof(size_t));
+            for (size_t i = 0; i < n; ++i)
+                count[(rec_field(&a[i], f) >> shift) & 0xFFFF]++;
+            if (count[(rec_field(&a[0], f) >> shift) & 0xFFFF] == n) continue;
+
+            size_t sum = 0;
+            for (size_t d = 0; d < 65536; ++d) {
+                size_t c = count[d];
+                count[d] = sum;
+                sum += c;
+            }
+            for (size_t i = 0; i < n; ++i)
+                b[count[(rec_field(&a[i], f) >> shift) & 0xFFFF]++] = a[i];
+            Rec* sw = a; a = b; b = sw;
+        }
+    }
+    free(count);
+    return a;
+}
+
+static inline uint32_t zig(uint32_t d) { return (d << 1) ^ (uint32_t)-(int32_t)(d >> 31); }
+static inline uint32_t unzig(uint32_t z) { return (z >> 1) ^ (uint32_t)-(int32_t)(z & 1); }
+
+static unsigned width(uint32_t x) { return x ? 32 - (unsigned)__builtin_clz(x) : 0; }
+
+/* Columns use a vertical layout: value i of a block lives in lane i % 4,
+   and each lane is its own bit stream of 32 values, interleaved one
+   32-bit word per lane. A b-bit column is then exactly 16 * b bytes and
+   unpacks four values per shift, with no cross-lane work. */
+typedef uint32_t v4u __attribute__((vector_size(16)));
+
+static size_t put_bits(uint8_t* out, const uint32_t* v, unsigned b) {
+    uint32_t words[4 * 32] = { 0 };
+    for (unsigned i = 0; i < KG_PACK_BLOCK; ++i) {
+        unsigned pos = (i / 4) * b, lane = i % 4;
+        unsigned wi = pos / 32, sh = pos % 32;
+        words[4 * wi + lane] |= v[i] << sh;
+        if (sh + b > 32) words[4 * (wi + 1) + lane] |= v[i] >> (32 - sh);
+    }
+    memcpy(out, words, 16 * b);
+    return 16 * b;
+}
+
+static inline __attribute__((always_inline))
+void unpack(const uint8_t* in, uint32_t* out, unsigned b) {
+    uint32_t m = b == 32 ? UINT32_MAX : (1u << b) - 1;
+    v4u mask = { m, m, m, m };
+#pragma GCC unroll 32
+    for (unsigned j = 0; j < KG_PACK_BLOCK / 4; ++j) {
+        unsigned pos = j * b, wi = pos / 32, sh = pos % 32;
+        v4u lo, hi;
+        memcpy(&lo, in + 16 * wi, 16);
+        v4u v = lo >> sh;
+        if (sh + b > 32) {
+            memcpy(&hi, in + 16 * (wi + 1), 16);
+            v |= hi << (32 - sh);
+        }
+        v &= mask;
+        memcpy(out + 4 * j, &v, 16);
+    }
+}
+
+#define UNPACK(b) case b: unpack(in, v, b); break;
+
+/* A 0-bit column is all zeros. Widths are switched to constants so each
+   case compiles to straight-line shifts. */
+static const uint8_t* get_bits(const uint8_t* in, uint32_t* v, unsigned b) {
+    switch (b) {
+    case 0:
+        memset(v, 0, KG_PACK_BLOCK * sizeof(uint32_t));
+        return in;
+    UNPACK(1)  UNPACK(2)  UNPACK(3)  UNPACK(4)  UNPACK(5)  UNPACK(6)  UNPACK(7)  UNPACK(8)
+    UNPACK(9)  UNPACK(10) UNPACK(11) UNPACK(12) UNPACK(13) UNPACK(14) UNPACK(15) UNPACK(16)
+    UNPACK(17) UNPACK(18) UNPACK(19) UNPACK(20) UNPACK(21) UNPACK(22) UNPACK(23) UNPACK(24)
+    default: unpack(in, v, b); break;
+    }
+    return in + 16 * b;
+}
+
+void kg_pack(const KGContext* ctx, TriplePack* pk) {
+    const TripleStore* ts = &ctx->triples;
+    size_t n = ts->n;
+    memset(pk, 0, sizeof(*pk));
+
+    Rec* a = malloc((n ? n : 1) * sizeof(Rec));
+    Rec* b = malloc((n ? n : 1) * sizeof(Rec));
+    for (size_t i = 0; i < n; ++i) {
+        a[i].t = ts->t[i];
+        a[i].w = ts->w ? ts->w[i] : 1;
+    }
+    Rec* r = n ? sort_recs(a, b, n) : a;
+
+    // Fold repeats; weights saturate like kg_add_weighted.
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (m && memcmp(&r[m - 1].t, &r[i].t, sizeof(Triple)) == 0) {
+            uint32_t w = r[m - 1].w + r[i].w;
+            r[m - 1].w = w < r[i].w ? UINT32_MAX : w;
+        } else {
+            r[m++] = r[i];
+        }
+        if (r[m - 1].w != 1) pk->weighted = 1;
+    }
+
+    pk->n = m;
+    pk->n_blocks = (m + KG_PACK_BLOCK - 1) / KG_PACK_BLOCK;
+    pk->blocks = malloc((pk->n_blocks ? pk->n_blocks : 1) * sizeof(PackBlock));
+
+    // A block never needs more than 4 full-width columns. The last one is
+    // padded with zeros to a full block.
+    size_t cap = 0, at = 0;
+    const size_t block_max = 4 * KG_PACK_BLOCK * sizeof(uint32_t);
+    uint32_t col[4][KG_PACK_BLOCK];
+    for (size_t k = 0; k < pk->n_blocks; ++k) {
+        const Rec* blk = r + k * KG_PACK_BLOCK;
+        size_t cnt = m - k * KG_PACK_BLOCK < KG_PACK_BLOCK ? m - k * KG_PACK_BLOCK : KG_PACK_BLOCK;
+        uint32_t any[4] = { 0, 0, 0, 0 };
+        memset(col, 0, sizeof(col));
+        for (size_t j = 0; j < cnt; ++j) {
+            Triple t = blk[j].t;
+            Triple prev = blk[j ? j - 1 : 0].t;
+            col[0][j] = t.s - prev.s;
+            col[1][j] = zig(t.p - prev.p);
+            col[2][j] = (t.s == prev.s && t.p == prev.p) ? t.o - prev.o : t.o;
+            col[3][j] = blk[j].w - 1;
+            for (int c = 0; c < 4; ++c) any[c] |= col[c][j];
+        }
+
+        if (at + block_max > cap) {
+            while (at + block_max > cap) cap = cap ? cap * 2 : 65536;
+            pk->data = realloc(pk->data, cap);
+        }
+        PackBlock* pb = &pk->blocks[k];
+        pb->first = blk[0].t;
+        pb->off = at;
+        pb->bits = 0;
+        for (int c = 0; c < 4; ++c) {
+            unsigned bw = width(any[c]);
+            pb->bits |= bw << (8 * c);
+            if (bw) at += put_bits(pk->data + at, col[c], bw);
+        }
+    }
+
+    free(a);
+    free(b);
+    pk->bytes = at;
+    pk->data = realloc(pk->data, at ? at : 1);
+}
+
+void kg_pack_free(TriplePack* pk) {
+    free(pk->data);
+    free(pk->blocks);
+    memset(pk, 0, sizeof(*pk));
+}
+
+size_t kg_pack_bytes(const TriplePack* pk) {
+    return sizeof(*pk) + pk->bytes + pk->n_blocks * sizeof(PackBlock);
+}
+
+/* First block whose leading subject is >= s (upper: > s). */
+static size_t block_bound(const TriplePack* pk, EntityID s, int upper) {
+    size_t lo = 0, hi = pk->n_blocks;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        EntityID v = pk->blocks[mid].first.s;
+        if (v < s || (upper && v == s)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void kg_pack_scan(const TriplePack* pk, KGPackIter* it, EntityID s) {
+    it->pk = pk;
+    it->s = s;
+    it->i = it->n = 0;
+    if (s == KG_ANY) {
+        it->block = 0;
+        it->end = pk->n_blocks;
+    } else {
+        // The block before the first one starting at s may end with s.
+        size_t b = block_bound(pk, s, 0);
+        it->block = b ? b - 1 : 0;
+        it->end = block_bound(pk, s, 1);
+    }
+}
+
+static uint32_t decode_block(const TriplePack* pk, size_t k, Triple* out, uint32_t* w) {
+    const PackBlock* pb = &pk->blocks[k];
+    size_t cnt = pk->n - k * KG_PACK_BLOCK < KG_PACK_BLOCK ? pk->n - k * KG_PACK_BLOCK : KG_PACK_BLOCK;
+    uint32_t ds[KG_PACK_BLOCK], dp[KG_PACK_BLOCK], dobj[KG_PACK_BLOCK];
+
+    const uint8_t* in = pk->data + pb->off;
+    in = get_bits(in, ds, pb->bits & 0xFF);
+    in = get_bits(in, dp, (pb->bits >> 8) & 0xFF);
+    in = get_bits(in, dobj, (pb->bits >> 16) & 0xFF);
+    get_bits(in, w, pb->bits >> 24);
+
+    EntityID s = pb->first.s, p = pb->first.p, o = pb->first.o;
+    for (size_t j = 0; j < cnt; ++j) {
+        uint32_t a = ds[j], b = unzig(dp[j]);
+        s += a;
+        p += b;
+        o = (o & -(uint32_t)((a | b) == 0)) + dobj[j];     /* branchless: runs are short */
+        out[j] = (Triple){ s, p, o };
+        w[j] += 1;
+    }
+    return (uint32_t)cnt;
+}
+
+int kg_pack_fill(KGPackIter* it) {
+    while (it->block < it->end) {
+        uint32_t cnt = decode_block(it->pk, it->block++, it->t, it->w);
+        uint32_t lo = 0, hi = cnt;
+        if (it->s != KG_ANY) {
+            while (lo < hi && it->t[lo].s < it->s) lo++;
+            while (hi > lo && it->t[hi - 1].s > it->s) hi--;
+        }
+        if (lo < hi) {
+            it->i = lo;
+            it->n = hi;
+            return 1;
+        }
+    }
+    it->i = it->n = 0;
+    return 0;
+}
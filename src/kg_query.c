@@ -0,0 +1,409 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/* How a step sees each pattern position: a constant, a variable bound by
+   an earlier step, a variable it binds, or a repeat of one it binds. */
+enum { CONST, BOUND, FREE, DUP };
+
+/* Matches of a step's constants, grouped by the hash of its bound
+   positions: bucket b is item[start[b] .. start[b+1]). */
+typedef struct {
+    const Triple** item;
+    size_t* start;
+    size_t mask;
+} Table;
+
+typedef struct {
+    KGPattern pat;
+    int kind[3];
+    int hash;               /* hash join rather than an index lookup per row */
+    size_t scan;            /* matches of the constants alone */
+    double rows;            /* estimated rows after this step */
+    Table table;            /* built on first use */
+    KGIter it;              /* index cursor */
+    size_t at, end;         /* bucket cursor */
+} Step;
+
+struct KGQuery {
+    KGContext* ctx;
+    Step* step;             /* patterns in plan order */
+    size_t n;
+    int n_vars;
+    char* names[KG_QUERY_VARS];
+    int empty;              /* some constant is not in the store */
+    int depth;              /* step being iterated, -1 before the first row */
+    int done;
+    EntityID row[KG_QUERY_VARS];
+};
+
+/* Statistics */
+
+const PredicateStats* kg_predicate_stats(KGContext* ctx) {
+    PredicateStats* ps = &ctx->pstats;
+    size_t m = ctx->triples.n;
+    if (ps->count && ps->m == m && ps->version == ctx->triples.version) return ps;
+    if (ctx->index.version != ctx->triples.version || !ctx->index.spo) kg_index(ctx);
+
+    // POS is ordered by predicate first, so its last entry has the largest.
+    const TripleIndex* ix = &ctx->index;
+    size_t n = m ? ix->pos[m - 1].p + 1 : 1;
+    free(ps->count); free(ps->subjects); free(ps->objects);
+    ps->count = calloc(n, sizeof(size_t));
+    ps->subjects = calloc(n, sizeof(size_t));
+    ps->objects = calloc(n, sizeof(size_t));
+    ps->n_subjects = ps->n_objects = ps->n_preds = 0;
+
+    // Distinct values are the key changes along each sort order.
+    for (size_t i = 0; i < m; ++i) {
+        const Triple* t = &ix->spo[i];
+        int s_new = i == 0 || t[-1].s != t->s;
+        ps->n_subjects += s_new;
+        ps->subjects[t->p] += s_new || t[-1].p != t->p;
+    }
+    for (size_t i = 0; i < m; ++i) {
+        const Triple* t = &ix->pos[i];
+        int p_new = i == 0 || t[-1].p != t->p;
+        ps->count[t->p]++;
+        ps->n_preds += p_new;
+        ps->objects[t->p] += p_new || t[-1].o != t->o;
+    }
+    for (size_t i = 0; i < m; ++i)
+        ps->n_objects += i == 0 || ix->osp[i - 1].o != ix->osp[i].o;
+
+    ps->n = n;
+    ps->m = m;
+    ps->version = ctx->triples.version;
+    return ps;
+}
+
+/* Planning */
+
+static void kinds(const KGPattern* pt, uint32_t bound, int* kind) {
+    for (int k = 0; k < 3; ++k) {
+        int v = pt->var[k];
+        if (v < 0) kind[k] = CONST;
+        else if (bound >> v & 1) kind[k] = BOUND;
+        else if ((k > 0 && pt->var[0] == v) || (k > 1 && pt->var[1] == v)) kind[k] = DUP;
+        else kind[k] = FREE;
+    }
+}
+
+static uint32_t vars_of(const KGPattern* pt) {
+    uint32_t m = 0;
+    for (int k = 0; k < 3; ++k)
+        if (pt->var[k] >= 0) m |= 1u << pt->var[k];
+    return m;
+}
+
+/* Rows one input row yields: the constants' exact match count, divided
+   by the distinct values each bound position can take. */
+static double estimate(const PredicateStats* ps, const KGPattern* pt, const int* kind, size_t scan) {
+    double rows = (double)scan;
+    EntityID p = pt->id[1];
+    int per_pred = kind[1] == CONST && p < ps->n;
+    for (int k = 0; k < 3; k += 2) {
+        if (kind[k] != BOUND) continue;
+        size_t d = k == 0 ? (per_pred ? ps->subjects[p] : ps->n_subjects)
+                          : (per_pred ? ps->objects[p] : ps->n_objects);
+        rows /= d ? (double)d : 1.0;
+    }
+    if (kind[1] == BOUND) rows /= ps->n_preds ? (double)ps->n_preds : 1.0;
+    return rows;
+}
+
+static KGIter match_consts(KGContext* ctx, const Step* st) {
+    EntityID key[3];
+    for (int k = 0; k < 3; ++k) key[k] = st->kind[k] == CONST ? st->pat.id[k] : KG_ANY;
+    return kg_match(ctx, key[0], key[1], key[2]);
+}
+
+/* Greedy: next comes the pattern joined to what is already bound that
+   yields the fewest rows; unjoined patterns (cross products) go last. An
+   index lookup costs about log2(triples) per incoming row, so a pattern
+   whose constants match fewer triples than that is hashed instead. */
+static void plan(KGQuery* q, const KGPattern* pat) {
+    const PredicateStats* ps = kg_predicate_stats(q->ctx);
+    double probe = log2((double)ps->m + 2.0);
+    size_t n = q->n;
+    char* used = calloc(n, 1);
+    size_t* scan = malloc(n * sizeof(size_t));
+    for (size_t j = 0; j < n; ++j) {
+        Step st = { .pat = pat[j] };
+        kinds(&pat[j], 0, st.kind);
+        KGIter it = match_consts(q->ctx, &st);
+        scan[j] = q->empty ? 0 : kg_count(&it);
+    }
+
+    uint32_t bound = 0;
+    double rows = 1.0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t best = n;
+        int best_joined = 0;
+        double best_rows = 0.0;
+        for (size_t j = 0; j < n; ++j) {
+            if (used[j]) continue;
+            int kind[3];
+            kinds(&pat[j], bound, kind);
+            int joined = i == 0 || !(vars_of(&pat[j]) & ~bound) ||
+                         kind[0] == BOUND || kind[1] == BOUND || kind[2] == BOUND;
+            double r = estimate(ps, &pat[j], kind, scan[j]);
+            if (best == n || joined > best_joined || (joined == best_joined && r < best_rows)) {
+                best = j;
+                best_joined = joined;
+                best_rows = r;
+            }
+        }
+        used[best] = 1;
+        Step* st = &q->step[i];
+        st->pat = pat[best];
+        kinds(&st->pat, bound, st->kind);
+        st->scan = scan[best];
+        int keyed = st->kind[0] == BOUND || st->kind[1] == BOUND || st->kind[2] == BOUND;
+        st->hash = keyed && (double)st->scan < rows * probe;
+        rows *= best_rows;
+        st->rows = rows;
+        bound |= vars_of(&st->pat);
+    }
+    free(used);
+    free(scan);
+}
+
+/* Execution */
+
+static inline uint64_t hash_key(EntityID s, EntityID p, EntityID o) {
+    uint64_t h = ((uint64_t)s << 32 | o) * 0x9E3779B97F4A7C15ULL;
+    h ^= (uint64_t)p * 0xC2B2AE3D27D4EB4FULL;
+    return h ^ (h >> 29);
+}
+
+static inline EntityID field(const Triple* t, int k) {
+    return k == 0 ? t->s : k == 1 ? t->p : t->o;
+}
+
+static size_t triple_bucket(const Step* st, const Triple* t) {
+    EntityID v[3];
+    for (int k = 0; k < 3; ++k) v[k] = st->kind[k] == BOUND ? field(t, k) : 0;
+    return hash_key(v[0], v[1], v[2]) & st->table.mask;
+}
+
+static size_t row_bucket(const Step* st, const EntityID* row) {
+    EntityID v[3];
+    for (int k = 0; k < 3; ++k) v[k] = st->kind[k] == BOUND ? row[st->pat.var[k]] : 0;
+    return hash_key(v[0], v[1], v[2]) & st->table.mask;
+}
+
+static void build(KGContext* ctx, Step* st) {
+    Table* tb = &st->table;
+    KGIter it = match_consts(ctx, st);
+    size_t m = kg_count(&it), cap = 1;
+    while (cap < m) cap *= 2;
+    tb->mask = cap - 1;
+    tb->start = calloc(cap + 1, sizeof(size_t));
+    tb->item = malloc((m ? m : 1) * sizeof(*tb->item));
+    // Count, turn counts into bucket ends, then fill backwards so each
+    // bucket keeps index order and start[] ends up at bucket starts.
+    for (const Triple* t = it.cur; t < it.end; ++t) tb->start[triple_bucket(st, t)]++;
+    for (size_t b = 1; b <= cap; ++b) tb->start[b] += tb->start[b - 1];
+    for (const Triple* t = it.end; t-- > it.cur; ) tb->item[--tb->start[triple_bucket(st, t)]] = t;
+}
+
+static void open_step(KGQuery* q, Step* st) {
+    if (st->hash) {
+        if (!st->table.start) build(q->ctx, st);
+        size_t b = row_bucket(st, q->row);
+        st->at = st->table.start[b];
+        st->end = st->table.start[b + 1];
+        return;
+    }
+    EntityID key[3];
+    for (int k = 0; k < 3; ++k)
+        key[k] = st->kind[k] == CONST ? st->pat.id[k] : st->kind[k] == BOUND ? q->row[st->pat.var[k]] : KG_ANY;
+    st->it = kg_match(q->ctx, key[0], key[1], key[2]);
+}
+
+/* Checks t against the step and binds its new variables. */
+static int bind(EntityID* row, const Step* st, const Triple* t) {
+    for (int k = 0; k < 3; ++k) {
+        EntityID v = field(t, k);
+        switch (st->kind[k]) {
+        case CONST: if (v != st->pat.id[k]) return 0; break;
+        case FREE:  row[st->pat.var[k]] = v; break;
+        default:    if (v != row[st->pat.var[k]]) return 0; break;
+        }
+    }
+    return 1;
+}
+
+static const Triple* advance(KGQuery* q, Step* st) {
+    for (;;) {
+        const Triple* t = st->hash ? (st->at < st->end ? st->table.item[st->at++] : NULL) : kg_next(&st->it);
+        if (!t || bind(q->row, st, t)) return t;
+    }
+}
+
+const EntityID* kg_query_next(KGQuery* q) {
+    if (q->done) return NULL;
+    int d = q->depth;
+    if (d < 0) {
+        if (q->empty) { q->done = 1; return NULL; }
+        open_step(q, &q->step[0]);
+        d = 0;
+    }
+    while (d >= 0) {
+        if (!advance(q, &q->step[d])) { d--; continue; }
+        if ((size_t)d + 1 == q->n) { q->depth = d; return q->row; }
+        open_step(q, &q->step[++d]);
+    }
+    q->done = 1;
+    return NULL;
+}
+
+/* Construction */
+
+KGQuery* kg_query_patterns(KGContext* ctx, const KGPattern* pat, size_t n, int n_vars) {
+    if (n == 0 || n_vars < 0 || n_vars > KG_QUERY_VARS) {
+        fprintf(stderr, "Query: %s\n", n ? "too many variables" : "no patterns");
+        return NULL;
+    }
+    for (size_t j = 0; j < n; ++j)
+        for (int k = 0; k < 3; ++k)
+            if (pat[j].var[k] >= n_vars) {
+                fprintf(stderr, "Query: variable %d out of range\n", pat[j].var[k]);
+                return NULL;
+            }
+
+    KGQuery* q = calloc(1, sizeof(KGQuery));
+    q->ctx = ctx;
+    q->step = calloc(n, sizeof(Step));
+    q->n = n;
+    q->n_vars = n_vars;
+    q->depth = -1;
+    for (int v = 0; v < n_vars; ++v) {
+        char name[16];
+        snprintf(name, sizeof(name), "?%d", v);
+        q->names[v] = strdup(name);
+    }
+    for (size_t j = 0; j < n; ++j)
+        for (int k = 0; k < 3; ++k)
+            if (pat[j].var[k] < 0 && pat[j].id[k] == INVALID_ID) q->empty = 1;
+    plan(q, pat);
+    return q;
+}
+
+static inline int space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+/* Reads one term into buf: returns its length, or -1 at the end of the
+   text, -2 for a lone "." and -3 for an unterminated string. */
+static long term(const char** sp, char* buf, int* quoted) {
+    const char* s = *sp;
+    while (space(*s)) s++;
+    long n = 0;
+    *quoted = *s == '"';
+    if (!*s) n = -1;
+    else if (*s == '.' && (!s[1] || space(s[1]))) { s++; n = -2; }
+    else if (*quoted) {
+        for (s++; *s && *s != '"'; s++) {
+            if (*s == '\\' && s[1]) s++;
+            buf[n++] = *s;
+        }
+        if (*s) s++; else n = -3;
+    } else {
+        while (*s && !space(*s)) buf[n++] = *s++;
+    }
+    *sp = s;
+    return n;
+}
+
+KGQuery* kg_query(KGContext* ctx, const char* text) {
+    KGPattern* pat = NULL;
+    size_t n = 0, cap = 0;
+    char* names[KG_QUERY_VARS];
+    int n_vars = 0, k = 0;
+    const char* err = NULL;
+    char* buf = malloc(strlen(text) + 1);
+    const char* s = text;
+
+    for (;;) {
+        const char* at = s;
+        int quoted;
+        long len = term(&s, buf, &quoted);
+        if (len == -3) { err = "unterminated string"; s = at; break; }
+        if (len < 0) {
+            if (k != 0 && k != 3) { err = "a pattern needs three terms"; break; }
+            if (k == 0 && len == -2) { err = "empty pattern"; break; }
+            k = 0;
+            if (len == -1) break;
+            continue;
+        }
+        if (k == 3) { err = "expected \".\" between patterns"; s = at; break; }
+        if (k == 0) {
+            if (n == cap) pat = realloc(pat, (cap = cap ? cap * 2 : 4) * sizeof(KGPattern));
+            n++;
+        }
+        KGPattern* pt = &pat[n - 1];
+        if (!quoted && buf[0] == '?' && len > 1) {
+            int v = 0;
+            while (v < n_vars && !(strlen(names[v]) == (size_t)len && memcmp(names[v], buf, len) == 0)) v++;
+            if (v == n_vars) {
+                if (n_vars == KG_QUERY_VARS) { err = "too many variables"; s = at; break; }
+                names[n_vars++] = strndup(buf, len);
+            }
+            pt->var[k] = v;
+            pt->id[k] = INVALID_ID;
+        } else {
+            // Unknown strings stay INVALID_ID: the query then has no rows.
+            pt->var[k] = -1;
+            pt->id[k] = kg_lookup_n(ctx, buf, (size_t)len);
+        }
+        k++;
+    }
+    free(buf);
+
+    KGQuery* q = NULL;
+    if (err) fprintf(stderr, "Query: %s at offset %zu\n", err, (size_t)(s - text));
+    else q = kg_query_patterns(ctx, pat, n, n_vars);
+    for (int v = 0; v < n_vars; ++v) {
+        if (q) { free(q->names[v]); q->names[v] = names[v]; }
+        else free(names[v]);
+    }
+    free(pat);
+    return q;
+}
+
+int kg_query_vars(const KGQuery* q) {
+    return q->n_vars;
+}
+
+const char* kg_query_var(const KGQuery* q, int var) {
+    return var >= 0 && var < q->n_vars ? q->names[var] : "<invalid>";
+}
+
+void kg_query_explain(const KGQuery* q) {
+    for (size_t i = 0; i < q->n; ++i) {
+        const Step* st = &q->step[i];
+        char line[256];
+        size_t len = 0;
+        for (int k = 0; k < 3; ++k) {
+            const char* t = st->pat.var[k] < 0 ? kg_str(q->ctx, st->pat.id[k]) : q->names[st->pat.var[k]];
+            len += snprintf(line + len, sizeof(line) - len, "%s%s", k ? " " : "", t);
+            if (len >= sizeof(line)) len = sizeof(line) - 1;
+        }
+        int keyed = st->kind[0] == BOUND || st->kind[1] == BOUND || st->kind[2] == BOUND;
+        fprintf(stderr, "%s%zu. %-36s %-5s  %zu matches, ~%.0f rows\n", i ? "          " : "Plan    : ",
+                i + 1, line, st->hash ? "hash" : keyed ? "index" : "scan", st->scan, st->rows);
+    }
+}
+
+void kg_query_free(KGQuery* q) {
+    if (!q) return;
+    for (size_t i = 0; i < q->n; ++i) {
+        free(q->step[i].table.item);
+        free(q->step[i].table.start);
+    }
+    for (int v = 0; v < q->n_vars; ++v) free(q->names[v]);
+    free(q->step);
+    free(q);
+}
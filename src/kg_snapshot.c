@@ -0,0 +1,314 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Snapshot layout: header, then 8-byte aligned sections in this order:
+   triples, triple weights (optional), string offsets, string lengths,
+   hash slots, string pool. Everything is stored in host byte order and
+   mapped as is. */
+
+static const char MAGIC[8] = "KGSNAP1";
+#define VERSION 3
+
+#define FLAG_DEDUP 1u
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t n_strings, n_triples, pool_size, slot_cap, n_sentences;
+    uint64_t off_triples, off_weights, off_stroff, off_strlen, off_slots, off_pool;
+    uint64_t file_size;
+    uint64_t data_checksum;     /* over every byte after the header */
+    uint64_t header_checksum;   /* over the header up to this field */
+} SnapshotHeader;
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+typedef struct { uint64_t h; uint64_t carry; unsigned nc; } Checksum;
+
+static void sum_init(Checksum* c) { c->h = 0x9E3779B97F4A7C15ULL; c->carry = 0; c->nc = 0; }
+
+static inline void sum_word(Checksum* c, uint64_t w) {
+    c->h = (c->h ^ w) * 0xFF51AFD7ED558CCDULL;
+    c->h ^= c->h >> 29;
+}
+
+static void sum_bytes(Checksum* c, const void* p, size_t n) {
+    const unsigned char* b = p;
+    while (n && c->nc) {
+        c->carry |= (uint64_t)*b++ << (8 * c->nc);
+        n--;
+        if (++c->nc == 8) { sum_word(c, c->carry); c->carry = 0; c->nc = 0; }
+    }
+    for (; n >= 8; n -= 8, b += 8) {
+        uint64_t w;
+        memcpy(&w, b, 8);
+        sum_word(c, w);
+    }
+    while (n--) {
+        c->carry |= (uint64_t)*b++ << (8 * c->nc);
+        if (++c->nc == 8) { sum_word(c, c->carry); c->carry = 0; c->nc = 0; }
+    }
+}
+
+static uint64_t sum_final(Checksum* c) {
+    if (c->nc) sum_word(c, c->carry);
+    return c->h;
+}
+
+static uint64_t header_sum(const SnapshotHeader* h) {
+    Checksum c;
+    sum_init(&c);
+    sum_bytes(&c, h, offsetof(SnapshotHeader, header_checksum));
+    return sum_final(&c);
+}
+
+static int write_section(FILE* f, Checksum* c, const void* p, size_t n, uint64_t* at) {
+    static const char pad[8];
+    size_t np = ALIGN8(n) - n;
+    if (n && fwrite(p, 1, n, f) != n) return -1;
+    if (np && fwrite(pad, 1, np, f) != np) return -1;
+    sum_bytes(c, p, n);
+    sum_bytes(c, pad, np);
+    *at += n + np;
+    return 0;
+}
+
+/* Makes a rename into path's directory durable. */
+static int sync_dir(const char* path) {
+    char dir[4096];
+    const char* slash = strrchr(path, '/');
+    size_t n = slash ? (size_t)(slash - path) : 0;
+    if (n >= sizeof(dir)) return -1;
+    if (slash && n == 0) n = 1;     // the root
+    memcpy(dir, slash ? path : ".", slash ? n : 1);
+    dir[slash ? n : 1] = 0;
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return -1;
+    int err = fsync(fd) != 0;
+    return close(fd) != 0 || err ? -1 : 0;
+}
+
+int kg_save(const KGContext* ctx, const char* path) {
+    const StringTable* st = &ctx->strings;
+    SnapshotHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MAGIC, sizeof(h.magic));
+    h.version = VERSION;
+    h.header_size = sizeof(h);
+    h.n_strings = st->n;
+    h.n_triples = ctx->triples.n;
+    h.pool_size = st->pool_n;
+    h.slot_cap = st->slot_cap;
+    h.n_sentences = ctx->sentences;
+    h.flags = ctx->triples.dedup ? FLAG_DEDUP : 0;
+
+    uint64_t at = ALIGN8(sizeof(h));
+    h.off_triples = at;  at += ALIGN8(h.n_triples * sizeof(Triple));
+    if (ctx->triples.w) { h.off_weights = at;  at += ALIGN8(h.n_triples * sizeof(uint32_t)); }
+    h.off_stroff  = at;  at += ALIGN8(h.n_strings * sizeof(uint64_t));
+    h.off_strlen  = at;  at += ALIGN8(h.n_strings * sizeof(uint32_t));
+    h.off_slots   = at;  at += ALIGN8(h.slot_cap * sizeof(StringSlot));
+    h.off_pool    = at;  at += ALIGN8(h.pool_size);
+    h.file_size   = at;
+
+    // Write next to the target and rename, so readers never map a torn file.
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) return -1;
+    FILE* f = fopen(tmp, "wb");
+    if (!f) { perror("fopen"); return -1; }
+
+    Checksum c;
+    sum_init(&c);
+    uint64_t pos = ALIGN8(sizeof(h));
+    int err = fseek(f, (long)pos, SEEK_SET) != 0;
+    err = err || write_section(f, &c, ctx->triples.t, h.n_triples * sizeof(Triple), &pos);
+    if (ctx->triples.w)
+        err = err || write_section(f, &c, ctx->triples.w, h.n_triples * sizeof(uint32_t), &pos);
+    err = err || write_section(f, &c, st->off, h.n_strings * sizeof(uint64_t), &pos);
+    err = err || write_section(f, &c, st->len, h.n_strings * sizeof(uint32_t), &pos);
+    err = err || write_section(f, &c, st->slots, h.slot_cap * sizeof(StringSlot), &pos);
+    err = err || write_section(f, &c, st->pool, h.pool_size, &pos);
+    h.data_checksum = sum_final(&c);
+    h.header_checksum = header_sum(&h);
+    err = err || fseek(f, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, f) != 1;
+    // The data must be on disk before the rename makes it the snapshot: a
+    // log compacted into it is truncated once this returns.
+    err = err || fflush(f) != 0 || fsync(fileno(f)) != 0;
+    err = fclose(f) != 0 || err;
+    if (err || rename(tmp, path) != 0) {
+        perror("kg_save");
+        remove(tmp);
+        return -1;
+    }
+    if (sync_dir(path) != 0) {
+        perror("kg_save");
+        return -1;
+    }
+    return 0;
+}
+
+int kg_is_snapshot(const char* path) {
+    char magic[8];
+    FILE* f = fopen(path, "rb");
+    if (!f) return 0;
+    int ok = fread(magic, 1, sizeof(magic), f) == sizeof(magic) &&
+             memcmp(magic, MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return ok;
+}
+
+static int section_ok(const SnapshotHeader* h, uint64_t off, uint64_t bytes) {
+    return off % 8 == 0 && off >= sizeof(*h) && off <= h->file_size &&
+           bytes <= h->file_size - off;
+}
+
+/* Maps path read-only and checks what opening needs, all in the header:
+   magic, version, checksum, size and that every section lies inside the
+   file. The data itself is not read. Returns the mapping or NULL. */
+static void* map_snapshot(const char* path, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror("open"); return NULL; }
+    struct stat sb;
+    if (fstat(fd, &sb) != 0 || (size_t)sb.st_size < sizeof(SnapshotHeader)) {
+        fprintf(stderr, "%s: not a snapshot\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    void* map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { perror("mmap"); return NULL; }
+
+    // Lookups probe until an empty slot, so the table must have some:
+    // a power of two at most half full, as kg_intern keeps it.
+    const SnapshotHeader* h = map;
+    const char* why = NULL;
+    if (memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0) why = "bad magic";
+    else if (h->version != VERSION) why = "unsupported version";
+    else if (h->header_size != sizeof(*h) || h->header_checksum != header_sum(h)) why = "corrupt header";
+    else if (h->file_size != (uint64_t)sb.st_size) why = "truncated file";
+    else if (h->n_strings >= UINT32_MAX || h->n_triples > h->file_size / sizeof(Triple) ||
+             h->slot_cap > h->file_size / sizeof(StringSlot) || (h->slot_cap & (h->slot_cap - 1)) != 0 ||
+             (h->n_strings && h->slot_cap < 2) || 2 * h->n_strings > h->slot_cap ||
+             !section_ok(h, h->off_triples, h->n_triples * sizeof(Triple)) ||
+             (h->off_weights && !section_ok(h, h->off_weights, h->n_triples * sizeof(uint32_t))) ||
+             !section_ok(h, h->off_stroff, h->n_strings * sizeof(uint64_t)) ||
+             !section_ok(h, h->off_strlen, h->n_strings * sizeof(uint32_t)) ||
+             !section_ok(h, h->off_slots, h->slot_cap * sizeof(StringSlot)) ||
+             !section_ok(h, h->off_pool, h->pool_size))
+        why = "bad section table";
+    if (why) {
+        fprintf(stderr, "%s: %s\n", path, why);
+        munmap(map, (size_t)sb.st_size);
+        return NULL;
+    }
+    *size = (size_t)sb.st_size;
+    return map;
+}
+
+int kg_open_mmap(KGContext* ctx, const char* path) {
+    double t0 = KG_CLOCK();
+    size_t size;
+    void* map = map_snapshot(path, &size);
+    if (!map) return -1;
+    const SnapshotHeader* h = map;
+
+    // Point the context straight at the mapping; caps equal sizes so
+    // nothing is grown in place. kg_detach copies before any write.
+    char* base = map;
+    StringTable* st = &ctx->strings;
+    st->pool  = base + h->off_pool;
+    st->pool_n = st->pool_cap = h->pool_size;
+    st->off   = (uint64_t*)(base + h->off_stroff);
+    st->len   = (uint32_t*)(base + h->off_strlen);
+    st->n = st->cap = h->n_strings;
+    st->slots = (StringSlot*)(base + h->off_slots);
+    st->slot_cap = h->slot_cap;
+    ctx->triples.t = (Triple*)(base + h->off_triples);
+    ctx->triples.w = h->off_weights ? (uint32_t*)(base + h->off_weights) : NULL;
+    ctx->triples.n = ctx->triples.cap = h->n_triples;
+    ctx->triples.dedup = (h->flags & FLAG_DEDUP) != 0;
+    ctx->sentences = h->n_sentences;
+    ctx->map = map;
+    ctx->map_size = size;
+    KG_PHASE(ctx, KG_PHASE_LOAD, t0);
+    return 0;
+}
+
+/* Everything kg_str, kg_lookup and the indexes index by: strings inside
+   the pool and NUL-terminated, slots and triples naming strings that
+   exist, and enough empty slots for probing to stop. */
+static int contents_ok(const SnapshotHeader* h, const char* base) {
+    const char* pool = base + h->off_pool;
+    const uint64_t* off = (const uint64_t*)(base + h->off_stroff);
+    const uint32_t* len = (const uint32_t*)(base + h->off_strlen);
+    for (size_t i = 0; i < h->n_strings; ++i)
+        if (off[i] >= h->pool_size || len[i] >= h->pool_size - off[i] || pool[off[i] + len[i]] != 0) return 0;
+    const StringSlot* slots = (const StringSlot*)(base + h->off_slots);
+    size_t used = 0;
+    for (size_t i = 0; i < h->slot_cap; ++i) {
+        if (slots[i].id > h->n_strings) return 0;
+        used += slots[i].id != INVALID_ID;
+    }
+    if (used > h->n_strings) return 0;
+    const Triple* t = (const Triple*)(base + h->off_triples);
+    for (size_t i = 0; i < h->n_triples; ++i)
+        if (!t[i].s || t[i].s > h->n_strings || !t[i].p || t[i].p > h->n_strings ||
+            !t[i].o || t[i].o > h->n_strings) return 0;
+    return 1;
+}
+
+int kg_verify(const char* path) {
+    size_t size;
+    void* map = map_snapshot(path, &size);
+    if (!map) return -1;
+    const SnapshotHeader* h = map;
+    const char* why = NULL;
+    if (kg_checksum((const char*)map + ALIGN8(sizeof(*h)), h->file_size - ALIGN8(sizeof(*h))) != h->data_checksum)
+        why = "data checksum mismatch";
+    else if (!contents_ok(h, map))
+        why = "corrupt contents";
+    if (why) fprintf(stderr, "%s: %s\n", path, why);
+    munmap(map, size);
+    return why ? -1 : 0;
+}
+
+uint64_t kg_checksum(const void* p, size_t n) {
+    Checksum c;
+    sum_init(&c);
+    sum_bytes(&c, p, n);
+    return sum_final(&c);
+}
+
+uint64_t kg_snapshot_tag(const KGContext* ctx) {
+    return ctx->map ? ((const SnapshotHeader*)ctx->map)->header_checksum : 0;
+}
+
+static void* copy_out(const void* p, size_t bytes) {
+    void* q = malloc(bytes ? bytes : 1);
+    memcpy(q, p, bytes);
+    return q;
+}
+
+void kg_detach(KGContext* ctx) {
+    if (!ctx->map) return;
+    StringTable* st = &ctx->strings;
+    st->pool  = copy_out(st->pool, st->pool_n);
+    st->off   = copy_out(st->off, st->n * sizeof(uint64_t));
+    st->len   = copy_out(st->len, st->n * sizeof(uint32_t));
+    st->slots = copy_out(st->slots, st->slot_cap * sizeof(StringSlot));
+    ctx->triples.t = copy_out(ctx->triples.t, ctx->triples.n * sizeof(Triple));
+    if (ctx->triples.w) ctx->triples.w = copy_out(ctx->triples.w, ctx->triples.n * sizeof(uint32_t));
+    munmap(ctx->map, ctx->map_size);
+    ctx->map = NULL;
+    ctx->map_size = 0;
+}
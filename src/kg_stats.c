@@ -0,0 +1,89 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+void kg_stats(const KGContext* ctx, KGStats* out) {
+    *out = ctx->stats;
+}
+
+void kg_stats_reset(KGContext* ctx) {
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+}
+
+double kg_clock_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec * 1e-6;
+}
+
+void kg_stats_phase(KGStats* s, int phase, double t0) {
+    s->phase_ms[phase] += kg_clock_ms() - t0;
+    s->phase_calls[phase]++;
+}
+
+// Layout results are not sums: the newer run wins.
+void kg_stats_add(KGStats* to, const KGStats* from) {
+    for (int i = 0; i < KG_PHASES; ++i) {
+        to->phase_ms[i] += from->phase_ms[i];
+        to->phase_calls[i] += from->phase_calls[i];
+    }
+    to->interns += from->interns;
+    to->intern_hits += from->intern_hits;
+    to->probes += from->probes;
+    to->rehashes += from->rehashes;
+    to->grows += from->grows;
+    to->grow_bytes += from->grow_bytes;
+    to->triples_added += from->triples_added;
+    to->triples_folded += from->triples_folded;
+    to->cooc_pairs += from->cooc_pairs;
+    to->cooc_edges += from->cooc_edges;
+    to->wal_records += from->wal_records;
+    to->wal_bytes += from->wal_bytes;
+    to->wal_syncs += from->wal_syncs;
+    to->compactions += from->compactions;
+    to->walks += from->walks;
+    to->walk_steps += from->walk_steps;
+    to->walk_rejects += from->walk_rejects;
+    to->layout_iterations += from->layout_iterations;
+    if (from->layout_iterations) {
+        to->layout_energy = from->layout_energy;
+        to->layout_step = from->layout_step;
+    }
+}
+
+void kg_stats_print(const KGStats* s) {
+#ifdef KG_NO_STATS
+    fprintf(stderr, "Stats   : compiled out (KG_NO_STATS)\n");
+    (void)s;
+#else
+    static const char* names[KG_PHASES] = { "load", "parse", "merge", "index", "freeze", "layout", "walk" };
+    for (int i = 0; i < KG_PHASES; ++i) {
+        if (!s->phase_calls[i]) continue;
+        fprintf(stderr, "Phase   : %-7s %9.1f ms  %llu call%s\n", names[i], s->phase_ms[i],
+                (unsigned long long)s->phase_calls[i], s->phase_calls[i] == 1 ? "" : "s");
+    }
+    fprintf(stderr, "Intern  : %llu calls, %llu hits, %llu misses, %.2f probes/call\n",
+            (unsigned long long)s->interns, (unsigned long long)s->intern_hits,
+            (unsigned long long)(s->interns - s->intern_hits),
+            s->interns ? (double)s->probes / s->interns : 0.0);
+    fprintf(stderr, "Grow    : %llu reallocs, %.1f MB carried, %llu rehashes\n",
+            (unsigned long long)s->grows, s->grow_bytes / 1048576.0, (unsigned long long)s->rehashes);
+    fprintf(stderr, "Triples : %llu added, %llu folded\n",
+            (unsigned long long)s->triples_added, (unsigned long long)s->triples_folded);
+    if (s->cooc_pairs)
+        fprintf(stderr, "Co-occur: %llu pairs counted, %llu edges\n",
+                (unsigned long long)s->cooc_pairs, (unsigned long long)s->cooc_edges);
+    if (s->wal_records || s->compactions)
+        fprintf(stderr, "Log     : %llu records, %.1f MB, %llu fsyncs, %llu compactions\n",
+                (unsigned long long)s->wal_records, s->wal_bytes / 1048576.0,
+                (unsigned long long)s->wal_syncs, (unsigned long long)s->compactions);
+    if (s->walks)
+        fprintf(stderr, "Walks   : %llu walks, %llu steps, %llu node2vec rejects\n",
+                (unsigned long long)s->walks, (unsigned long long)s->walk_steps,
+                (unsigned long long)s->walk_rejects);
+    if (s->layout_iterations)
+        fprintf(stderr, "Layout  : %llu iterations, energy %.4g, step %.3f px\n",
+                (unsigned long long)s->layout_iterations, s->layout_energy, s->layout_step);
+#endif
+}
@@ -0,0 +1,442 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KG_X86 1
+#endif
+
+/* Byte-class tables for one delimiter set. The nibble tables drive the
+   pshufb lookup: byte b is a delimiter iff lo[b & 15] & hi[b >> 4] != 0,
+   which covers every ASCII byte; bytes >= 0x80 never are. */
+typedef struct {
+    uint8_t is[256];
+    uint8_t lo[16], hi[16];
+} DelimTables;
+
+void kg_set_delims(KGContext* ctx, const char* delims) {
+    memset(ctx->delims, 0, sizeof(ctx->delims));
+    for (const unsigned char* c = (const unsigned char*)delims; *c; ++c)
+        if (*c < 0x80) ctx->delims[*c >> 6] |= 1ULL << (*c & 63);
+}
+
+static void build_tables(const KGContext* ctx, DelimTables* d) {
+    memset(d, 0, sizeof(*d));
+    for (int b = 0; b < 128; ++b) {
+        if (!(ctx->delims[b >> 6] >> (b & 63) & 1)) continue;
+        d->is[b] = 1;
+        d->lo[b & 15] |= (uint8_t)(1 << (b >> 4));
+    }
+    for (int h = 0; h < 8; ++h) d->hi[h] = (uint8_t)(1 << h);
+}
+
+/* Delimiter bitmask for the 64 bytes at p: bit i set iff p[i] is a delimiter. */
+static uint64_t classify_scalar(const uint8_t* p, const DelimTables* d) {
+    uint64_t m = 0;
+    for (int i = 0; i < 64; ++i) m |= (uint64_t)d->is[p[i]] << i;
+    return m;
+}
+
+#ifdef KG_X86
+__attribute__((target("ssse3")))
+static uint64_t classify_ssse3(const uint8_t* p, const DelimTables* d) {
+    const __m128i lo = _mm_loadu_si128((const __m128i*)d->lo);
+    const __m128i hi = _mm_loadu_si128((const __m128i*)d->hi);
+    const __m128i nib = _mm_set1_epi8(0x0F);
+    uint64_t m = 0;
+    for (int k = 0; k < 4; ++k) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + 16 * k));
+        __m128i a = _mm_shuffle_epi8(lo, _mm_and_si128(v, nib));
+        __m128i b = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(v, 4), nib));
+        __m128i z = _mm_cmpeq_epi8(_mm_and_si128(a, b), _mm_setzero_si128());
+        m |= (uint64_t)(uint16_t)~_mm_movemask_epi8(z) << (16 * k);
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static uint64_t classify_avx2(const uint8_t* p, const DelimTables* d) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)d->lo));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)d->hi));
+    const __m256i nib = _mm256_set1_epi8(0x0F);
+    uint64_t m = 0;
+    for (int k = 0; k < 2; ++k) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + 32 * k));
+        __m256i a = _mm256_shuffle_epi8(lo, _mm256_and_si256(v, nib));
+        __m256i b = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(v, 4), nib));
+        __m256i z = _mm256_cmpeq_epi8(_mm256_and_si256(a, b), _mm256_setzero_si256());
+        m |= (uint64_t)(uint32_t)~_mm256_movemask_epi8(z) << (32 * k);
+    }
+    return m;
+}
+#endif
+
+typedef uint64_t (*ClassifyFn)(const uint8_t*, const DelimTables*);
+
+static ClassifyFn pick_classifier(void) {
+#ifdef KG_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))  return classify_avx2;
+    if (__builtin_cpu_supports("ssse3")) return classify_ssse3;
+#endif
+    return classify_scalar;
+}
+
+typedef struct {
+    const char** p;
+    uint32_t* len;
+    EntityID* id;           /* filled by the caller, for co-occurrence */
+    size_t n, cap;
+} TokenList;
+
+static void push_token(TokenList* tl, const char* p, size_t len) {
+    if (tl->n == tl->cap) {
+        size_t cap = tl->cap ? tl->cap * 2 : 64;
+        tl->p = realloc(tl->p, cap * sizeof(*tl->p));
+        tl->len = realloc(tl->len, cap * sizeof(*tl->len));
+        tl->id = realloc(tl->id, cap * sizeof(*tl->id));
+        tl->cap = cap;
+    }
+    tl->p[tl->n] = p;
+    tl->len[tl->n++] = (uint32_t)len;
+}
+
+/* Split [p, le) into tokens. Whole 64-byte blocks are classified in place
+   as long as they stay inside the buffer; bits past le count as delimiters. */
+static void tokenize_line(const char* p, const char* le, const char* buf_end,
+                          const DelimTables* d, ClassifyFn classify, TokenList* out) {
+    const char* tok = NULL;
+    out->n = 0;
+    for (const char* b = p; b < le; b += 64) {
+        uint64_t m;
+        size_t left = (size_t)(le - b);
+        if (b + 64 <= buf_end) {
+            m = classify((const uint8_t*)b, d);
+        } else {
+            m = 0;
+            for (size_t i = 0; i < left; ++i) m |= (uint64_t)d->is[(uint8_t)b[i]] << i;
+        }
+        if (left < 64) m |= ~0ULL << left;
+
+        // Starts follow a delimiter, ends follow a token byte; they alternate.
+        uint64_t prev = (m << 1) | (tok ? 0 : 1);
+        uint64_t starts = ~m & prev;
+        uint64_t ends = m & ~prev;
+        if (tok && ends) {
+            push_token(out, tok, (size_t)(b + __builtin_ctzll(ends) - tok));
+            ends &= ends - 1;
+            tok = NULL;
+        }
+        while (starts) {
+            const char* s = b + __builtin_ctzll(starts);
+            starts &= starts - 1;
+            if (!ends) { tok = s; break; }
+            push_token(out, s, (size_t)(b + __builtin_ctzll(ends) - s));
+            ends &= ends - 1;
+        }
+    }
+    if (tok) push_token(out, tok, (size_t)(le - tok));
+}
+
+/* "sentence-N" without snprintf; returns the length. */
+static size_t sentence_name(char* buf, size_t n) {
+    char digits[20];
+    size_t k = 0;
+    do { digits[k++] = (char)('0' + n % 10); n /= 10; } while (n);
+    memcpy(buf, "sentence-", 9);
+    for (size_t i = 0; i < k; ++i) buf[9 + i] = digits[k - 1 - i];
+    return 9 + k;
+}
+
+static int is_space(unsigned char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+/* Maps the file, or reads it when it cannot be mapped (pipes, ttys).
+   *mapped tells the caller which release to use. */
+static char* open_text(const char* path, size_t* size, int* mapped) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror("open"); return NULL; }
+    struct stat sb;
+    *mapped = 0;
+    if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode)) {
+        *size = (size_t)sb.st_size;
+        if (*size == 0) { close(fd); return calloc(1, 1); }
+        void* m = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            madvise(m, *size, MADV_SEQUENTIAL);
+            close(fd);
+            *mapped = 1;
+            return m;
+        }
+    }
+
+    size_t cap = 1 << 16, n = 0;
+    char* buf = malloc(cap);
+    for (ssize_t r; (r = read(fd, buf + n, cap - n)) != 0; ) {
+        if (r < 0) { perror("read"); free(buf); close(fd); return NULL; }
+        n += (size_t)r;
+        if (n == cap) buf = realloc(buf, cap *= 2);
+    }
+    close(fd);
+    *size = n;
+    return buf;
+}
+
+static void close_text(char* buf, size_t size, int mapped) {
+    if (mapped) munmap(buf, size);
+    else free(buf);
+}
+
+/* Chunk state for the parallel loader. Each worker interns into its own
+   context, so IDs in `local` are chunk-local; sentences get SENT_BIT IDs
+   because their global number is only known once earlier chunks are counted. */
+#define SENT_BIT 0x80000000u
+#define PARALLEL_MIN (1u << 20)
+
+typedef struct {
+    KGContext local;
+    uint32_t* first_sent;   /* per local ID: chunk sentence that first used it */
+    size_t fs_cap;
+    EntityID* remap;        /* local ID -> global ID */
+    EntityID* sent_ids;     /* chunk sentence (1-based) -> global ID */
+    size_t sentences;
+    size_t out;             /* first global triple slot */
+    int dedup;
+    KGCooc* cooc;           /* chunk-local pair counts, or NULL */
+    const char *begin, *end, *buf_end;
+    const DelimTables* d;
+    ClassifyFn classify;
+    Triple* target;         /* global triple array, remap phase only */
+    uint32_t* target_w;     /* global weights, when the store has them */
+} Chunk;
+
+static void note_first(Chunk* c, EntityID id, size_t sentence) {
+    if (id > c->fs_cap) {
+        size_t cap = c->fs_cap ? c->fs_cap * 2 : 1024;
+        while (cap < id) cap *= 2;
+        c->first_sent = realloc(c->first_sent, cap * sizeof(uint32_t));
+        c->fs_cap = cap;
+    }
+    c->first_sent[id - 1] = (uint32_t)sentence;
+}
+
+static EntityID intern_noted(KGContext* ctx, Chunk* c, const char* p, size_t len, size_t sentence) {
+    size_t before = ctx->strings.n;
+    EntityID id = kg_intern_n(ctx, p, len);
+    if (c && ctx->strings.n != before) note_first(c, id, sentence);
+    return id;
+}
+
+/* Parses whole lines in [p, end). Without a chunk, sentence names are
+   interned as they are met, numbered after `base`. Word pairs go to cc
+   unless it is NULL. Returns the sentence count. */
+static size_t parse_lines(KGContext* ctx, Chunk* c, const char* p, const char* end, const char* buf_end,
+                          const DelimTables* d, ClassifyFn classify, KGCooc* cc, size_t base) {
+    EntityID doc      = intern_noted(ctx, c, "document", 8, 0);
+    EntityID contains = intern_noted(ctx, c, "contains", 8, 0);
+    EntityID next_to  = intern_noted(ctx, c, "next-to", 7, 0);
+    EntityID part_of  = intern_noted(ctx, c, "part-of", 7, 0);
+
+    TokenList toks = {0};
+    size_t sentences = 0;
+
+    for (const char* line = p; line < end; ) {
+        const char* le = memchr(line, '\n', (size_t)(end - line));
+        if (!le) le = end;
+        const char* l = line;
+        line = le + 1;
+
+        while (l < le && is_space((unsigned char)*l)) l++;
+        if (l == le || *l == '#') continue;
+
+        sentences++;
+        EntityID sentence;
+        if (c) {
+            sentence = SENT_BIT | (EntityID)sentences;
+        } else {
+            char sent_name[32];
+            size_t n = sentence_name(sent_name, base + sentences);
+            sentence = kg_intern_n(ctx, sent_name, n);
+        }
+
+        kg_add(ctx, sentence, part_of, doc);
+
+        tokenize_line(l, le, buf_end, d, classify, &toks);
+        EntityID prev = 0;
+        for (size_t i = 0; i < toks.n; ++i) {
+            EntityID word = intern_noted(ctx, c, toks.p[i], toks.len[i], sentences);
+            kg_add(ctx, sentence, contains, word);
+            if (prev) kg_add(ctx, prev, next_to, word);
+            prev = word;
+            toks.id[i] = word;
+        }
+        if (cc) kg_cooc_line(cc, toks.id, toks.p, toks.len, toks.n);
+    }
+
+    free(toks.p); free(toks.len); free(toks.id);
+    return sentences;
+}
+
+static void* parse_worker(void* arg) {
+    Chunk* c = arg;
+    kg_init(&c->local);
+    if (c->dedup) kg_set_dedup(&c->local, 1);
+    c->sentences = parse_lines(&c->local, c, c->begin, c->end, c->buf_end, c->d, c->classify, c->cooc, 0);
+    return NULL;
+}
+
+static void* remap_worker(void* arg) {
+    Chunk* c = arg;
+    const Triple* src = c->local.triples.t;
+    Triple* dst = c->target + c->out;
+    for (size_t i = 0; i < c->local.triples.n; ++i) {
+        EntityID s = src[i].s, o = src[i].o;
+        dst[i].s = s & SENT_BIT ? c->sent_ids[s & ~SENT_BIT] : c->remap[s];
+        dst[i].p = c->remap[src[i].p];
+        dst[i].o = o & SENT_BIT ? c->sent_ids[o & ~SENT_BIT] : c->remap[o];
+    }
+    // A chunk only keeps weights when deduplicating; the store may have
+    // them from earlier weighted adds regardless.
+    if (c->target_w && c->local.triples.w)
+        memcpy(c->target_w + c->out, c->local.triples.w, c->local.triples.n * sizeof(uint32_t));
+    else if (c->target_w)
+        for (size_t i = 0; i < c->local.triples.n; ++i) c->target_w[c->out + i] = 1;
+    return NULL;
+}
+
+static void run_workers(Chunk* chunks, size_t n, void* (*fn)(void*)) {
+    pthread_t* tid = malloc(n * sizeof(pthread_t));
+    for (size_t i = 1; i < n; ++i)
+        if (pthread_create(&tid[i], NULL, fn, &chunks[i]) != 0) { tid[i] = 0; fn(&chunks[i]); }
+    fn(&chunks[0]);
+    for (size_t i = 1; i < n; ++i)
+        if (tid[i]) pthread_join(tid[i], NULL);
+    free(tid);
+}
+
+/* Replays each chunk's first uses in serial order: sentence k's name, then
+   the strings first seen in sentence k. Global IDs therefore come out
+   exactly as the serial loader assigns them. */
+static void merge_chunk(KGContext* ctx, Chunk* c, size_t base) {
+    const StringTable* ls = &c->local.strings;
+    c->remap = malloc((ls->n + 1) * sizeof(EntityID));
+    c->sent_ids = malloc((c->sentences + 1) * sizeof(EntityID));
+    c->remap[0] = INVALID_ID;
+
+    size_t j = 0;
+    for (size_t k = 0; k <= c->sentences; ++k) {
+        if (k > 0) {
+            char sent_name[32];
+            c->sent_ids[k] = kg_intern_n(ctx, sent_name, sentence_name(sent_name, base + k));
+        }
+        for (; j < ls->n && c->first_sent[j] == k; ++j)
+            c->remap[j + 1] = kg_intern_n(ctx, ls->pool + ls->off[j], ls->len[j]);
+    }
+}
+
+static void load_parallel(KGContext* ctx, const char* buf, size_t size, const DelimTables* d,
+                          ClassifyFn classify, KGCooc* cc, size_t threads) {
+    Chunk* chunks = calloc(threads, sizeof(Chunk));
+    const char* end = buf + size;
+    const char* p = buf;
+    for (size_t i = 0; i < threads; ++i) {
+        const char* cut = i + 1 == threads ? end : buf + size / threads * (i + 1);
+        if (cut < p) cut = p;
+        if (cut < end) {
+            const char* nl = memchr(cut, '\n', (size_t)(end - cut));
+            cut = nl ? nl + 1 : end;
+        }
+        chunks[i] = (Chunk){ .begin = p, .end = cut, .buf_end = end, .d = d, .classify = classify,
+                             .dedup = ctx->triples.dedup, .cooc = cc ? kg_cooc_new(&ctx->cooc) : NULL };
+        p = cut;
+    }
+
+    double t0 = KG_CLOCK();
+    run_workers(chunks, threads, parse_worker);
+    for (size_t i = 0; i < threads; ++i) kg_stats_add(&ctx->stats, &chunks[i].local.stats);
+    KG_PHASE(ctx, KG_PHASE_PARSE, t0);
+    t0 = KG_CLOCK();
+
+    // The serial loader interns the predicates first even for an empty file.
+    parse_lines(ctx, NULL, end, end, end, d, classify, NULL, 0);
+
+    // Upper bounds: sentence names are at most 9 + 20 bytes with the NUL.
+    size_t strings = ctx->strings.n, pool = ctx->strings.pool_n, total = ctx->triples.n;
+    for (size_t i = 0; i < threads; ++i) {
+        strings += chunks[i].local.strings.n + chunks[i].sentences;
+        pool += chunks[i].local.strings.pool_n + 30 * chunks[i].sentences;
+        total += chunks[i].local.triples.n;
+    }
+    kg_reserve(ctx, strings, pool, total);
+
+    total = ctx->triples.n;
+    size_t base = ctx->sentences;
+    for (size_t i = 0; i < threads; ++i) {
+        merge_chunk(ctx, &chunks[i], base);
+        if (cc) kg_cooc_merge(cc, chunks[i].cooc, chunks[i].remap);
+        base += chunks[i].sentences;
+        chunks[i].out = total;
+        total += chunks[i].local.triples.n;
+    }
+    ctx->sentences = base;
+    for (size_t i = 0; i < threads; ++i) {
+        chunks[i].target = ctx->triples.t;
+        chunks[i].target_w = ctx->triples.w;
+    }
+    run_workers(chunks, threads, remap_worker);
+    ctx->triples.n = total;
+    ctx->triples.version++;
+    // Chunks deduplicated locally; fold repeats that span chunks.
+    if (ctx->triples.dedup) kg_set_dedup(ctx, 1);
+    KG_PHASE(ctx, KG_PHASE_MERGE, t0);
+
+    for (size_t i = 0; i < threads; ++i) {
+        kg_free(&chunks[i].local);
+        free(chunks[i].first_sent);
+        free(chunks[i].remap);
+        free(chunks[i].sent_ids);
+        kg_cooc_free(chunks[i].cooc);
+    }
+    free(chunks);
+}
+
+void kg_set_threads(KGContext* ctx, unsigned threads) {
+    ctx->threads = threads ? threads : 1;
+}
+
+int kg_load_text(KGContext* ctx, const char* path) {
+    size_t size;
+    int mapped;
+    double t0 = KG_CLOCK();
+    char* buf = open_text(path, &size, &mapped);
+    if (!buf) return -1;
+
+    DelimTables d;
+    build_tables(ctx, &d);
+    ClassifyFn classify = pick_classifier();
+
+    KGCooc* cc = ctx->cooc.window ? kg_cooc_new(&ctx->cooc) : NULL;
+    if (ctx->threads > 1 && size >= PARALLEL_MIN) {
+        load_parallel(ctx, buf, size, &d, classify, cc, ctx->threads);
+    } else {
+        double t1 = KG_CLOCK();
+        ctx->sentences += parse_lines(ctx, NULL, buf, buf + size, buf + size, &d, classify, cc, ctx->sentences);
+        KG_PHASE(ctx, KG_PHASE_PARSE, t1);
+    }
+    if (cc) {
+        kg_cooc_emit(ctx, cc);
+        kg_cooc_free(cc);
+    }
+
+    close_text(buf, size, mapped);
+    KG_PHASE(ctx, KG_PHASE_LOAD, t0);
+    return 0;
+}
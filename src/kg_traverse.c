@@ -0,0 +1,215 @@
+#include "../include/kg.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Direction-optimizing BFS (Beamer et al. 2012) over the CSR adjacency.
+   Top-down expands each frontier node's rows; bottom-up instead lets
+   every unvisited node look for a parent in the frontier, which wins
+   once the frontier holds a large share of the remaining edges. Levels
+   are appended to out->ids as they are found, so the frontier is always
+   the last level's slice of it. */
+
+#define ALPHA 14            /* go bottom-up once frontier edges > unexplored / ALPHA */
+#define BETA 24             /* back top-down once the frontier < nodes / BETA */
+
+typedef struct {
+    const Adjacency* g;
+    const KGTraverse* tv;
+    size_t n;               /* rows, including the empty row 0 */
+    uint64_t* seen;
+    uint64_t* front;        /* frontier bitset, only while bottom-up */
+    EntityID* parent;       /* NULL unless a path is wanted */
+    size_t (*span)[2];      /* scratch for spans(), one per predicate */
+    KGReach* out;
+} BFS;
+
+static inline int test_bit(const uint64_t* b, size_t i) { return b[i >> 6] >> (i & 63) & 1; }
+static inline void set_bit(uint64_t* b, size_t i) { b[i >> 6] |= 1ULL << (i & 63); }
+
+/* Rows are sorted by predicate, so each wanted predicate is one span
+   found by binary search rather than a test per edge. */
+static size_t lower(const EntityID* pred, size_t lo, size_t hi, EntityID p) {
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pred[mid] < p) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* Fills span with the [lo, hi) ranges of row edges to follow; returns how many. */
+static size_t spans(const KGTraverse* tv, const EntityID* pred, size_t lo, size_t hi, size_t (*span)[2]) {
+    if (!tv->preds) {
+        span[0][0] = lo;
+        span[0][1] = hi;
+        return lo < hi;
+    }
+    size_t k = 0;
+    for (size_t i = 0; i < tv->n_preds && lo < hi; ++i) {
+        size_t a = lower(pred, lo, hi, tv->preds[i]);
+        size_t z = lower(pred, a, hi, tv->preds[i] + 1);
+        if (a < z) {
+            span[k][0] = a;
+            span[k++][1] = z;
+        }
+    }
+    return k;
+}
+
+/* Row set d of v: 0 follows edges forward (s -> o), 1 backward. */
+static inline void row(const Adjacency* g, int d, EntityID v, size_t* lo, size_t* hi,
+                       const EntityID** nbr, const EntityID** pred) {
+    const size_t* off = d ? g->in_off : g->out_off;
+    *lo = off[v];
+    *hi = off[v + 1];
+    *nbr = d ? g->in_nbr : g->out_nbr;
+    *pred = d ? g->in_pred : g->out_pred;
+}
+
+static void visit(BFS* b, EntityID v, EntityID from, uint32_t hop) {
+    set_bit(b->seen, v);
+    if (b->parent) b->parent[v] = from;
+    b->out->ids[b->out->n] = v;
+    b->out->hops[b->out->n++] = hop;
+}
+
+/* Edge directions to follow from a node: forward for KG_OUT, backward
+   for KG_IN. Bottom-up looks the other way. */
+static inline int follows(int dir, int d) { return dir & (d ? KG_IN : KG_OUT); }
+
+static void top_down(BFS* b, size_t lo, size_t hi, uint32_t hop) {
+    for (size_t i = lo; i < hi; ++i) {
+        EntityID u = b->out->ids[i];
+        for (int d = 0; d < 2; ++d) {
+            if (!follows(b->tv->dir, d)) continue;
+            size_t e, end;
+            const EntityID *nbr, *pred;
+            row(b->g, d, u, &e, &end, &nbr, &pred);
+            size_t k = spans(b->tv, pred, e, end, b->span);
+            for (size_t j = 0; j < k; ++j)
+                for (e = b->span[j][0]; e < b->span[j][1]; ++e)
+                    if (!test_bit(b->seen, nbr[e])) visit(b, nbr[e], u, hop);
+        }
+    }
+}
+
+static void bottom_up(BFS* b, size_t lo, size_t hi, uint32_t hop) {
+    memset(b->front, 0, (b->n + 63) / 64 * sizeof(uint64_t));
+    for (size_t i = lo; i < hi; ++i) set_bit(b->front, b->out->ids[i]);
+    for (EntityID v = 1; v < b->n; ++v) {
+        if (test_bit(b->seen, v)) continue;
+        for (int d = 0; d < 2; ++d) {
+            if (!follows(b->tv->dir, !d)) continue;
+            size_t e, end;
+            const EntityID *nbr, *pred;
+            row(b->g, d, v, &e, &end, &nbr, &pred);
+            size_t k = spans(b->tv, pred, e, end, b->span);
+            EntityID from = INVALID_ID;
+            for (size_t j = 0; j < k && from == INVALID_ID; ++j)
+                for (e = b->span[j][0]; e < b->span[j][1]; ++e)
+                    if (test_bit(b->front, nbr[e])) { from = nbr[e]; break; }
+            if (from != INVALID_ID) {
+                visit(b, v, from, hop);
+                break;
+            }
+        }
+    }
+}
+
+/* Edges a top-down step would scan from v. */
+static size_t degree(const BFS* b, EntityID v) {
+    size_t deg = 0;
+    for (int d = 0; d < 2; ++d) {
+        if (!follows(b->tv->dir, d)) continue;
+        size_t e, end;
+        const EntityID *nbr, *pred;
+        row(b->g, d, v, &e, &end, &nbr, &pred);
+        size_t k = spans(b->tv, pred, e, end, b->span);
+        for (size_t j = 0; j < k; ++j) deg += b->span[j][1] - b->span[j][0];
+    }
+    return deg;
+}
+
+/* Runs levels until max_hops, an empty frontier, or dst is reached. */
+static void bfs(BFS* b, EntityID src, EntityID dst) {
+    size_t n = b->n;
+    size_t unexplored = b->g->m * ((b->tv->dir & KG_OUT ? 1 : 0) + (b->tv->dir & KG_IN ? 1 : 0));
+    b->seen = calloc((n + 63) / 64, sizeof(uint64_t));
+    b->span = malloc((b->tv->preds && b->tv->n_preds ? b->tv->n_preds : 1) * sizeof(*b->span));
+    b->out->ids = malloc(n * sizeof(EntityID));
+    b->out->hops = malloc(n * sizeof(uint32_t));
+    b->out->n = 0;
+    visit(b, src, INVALID_ID, 0);
+
+    int down = 0;
+    size_t lo = 0, hi = 1;
+    for (uint32_t hop = 1; lo < hi && (b->tv->max_hops < 0 || hop <= (uint32_t)b->tv->max_hops); ++hop) {
+        if (dst != INVALID_ID && test_bit(b->seen, dst)) break;
+        size_t edges = 0;
+        for (size_t i = lo; i < hi; ++i) edges += degree(b, b->out->ids[i]);
+        if (!down && edges > unexplored / ALPHA) down = 1;
+        else if (down && hi - lo < n / BETA) down = 0;
+        unexplored -= edges < unexplored ? edges : unexplored;
+
+        if (down) {
+            if (!b->front) b->front = malloc((n + 63) / 64 * sizeof(uint64_t));
+            bottom_up(b, lo, hi, hop);
+        } else {
+            top_down(b, lo, hi, hop);
+        }
+        lo = hi;
+        hi = b->out->n;
+    }
+    free(b->seen);
+    free(b->front);
+    free(b->span);
+}
+
+static const KGTraverse ALL = { NULL, 0, KG_BOTH, -1 };
+
+int kg_khop(KGContext* ctx, EntityID src, const KGTraverse* tv, KGReach* out) {
+    memset(out, 0, sizeof(*out));
+    const Adjacency* g = kg_freeze(ctx);
+    if (src == INVALID_ID || src >= g->n) return -1;
+    BFS b = { g, tv ? tv : &ALL, g->n, NULL, NULL, NULL, NULL, out };
+    bfs(&b, src, INVALID_ID);
+    out->ids = realloc(out->ids, out->n * sizeof(EntityID));
+    out->hops = realloc(out->hops, out->n * sizeof(uint32_t));
+    return 0;
+}
+
+int kg_path(KGContext* ctx, EntityID src, EntityID dst, const KGTraverse* tv, KGReach* out) {
+    memset(out, 0, sizeof(*out));
+    const Adjacency* g = kg_freeze(ctx);
+    if (src == INVALID_ID || src >= g->n || dst == INVALID_ID || dst >= g->n) return -1;
+
+    KGReach r;
+    BFS b = { g, tv ? tv : &ALL, g->n, NULL, NULL, NULL, NULL, &r };
+    b.parent = malloc(g->n * sizeof(EntityID));
+    bfs(&b, src, dst);
+
+    // dst is found iff it was visited; its level is its hop count.
+    size_t at = r.n;
+    while (at > 0 && r.ids[at - 1] != dst) at--;
+    int rc = -1;
+    if (at > 0) {
+        uint32_t len = r.hops[at - 1] + 1;
+        out->ids = malloc(len * sizeof(EntityID));
+        out->hops = malloc(len * sizeof(uint32_t));
+        out->n = len;
+        EntityID v = dst;
+        for (uint32_t i = len; i-- > 0; v = b.parent[v]) {
+            out->ids[i] = v;
+            out->hops[i] = i;
+        }
+        rc = 0;
+    }
+    free(b.parent);
+    kg_reach_free(&r);
+    return rc;
+}
+
+void kg_reach_free(KGReach* r) {
+    free(r->ids);
+    free(r->hops);
+    memset(r, 0, sizeof(*r));
+}
@@ -1,89 +1,18 @@
 #include "../include/kg.h"
+#include "../include/kg_draw.h"
+#include "../include/kg_export.h"
 #include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <math.h>
 
 #define WINDOW_W 1200
 #define WINDOW_H 800
 #define NODE_RADIUS 7
 
-typedef struct { float x, y; } Vec2;
 static Vec2* positions = NULL;
 
-static void* grow(void* p, size_t elem_size, size_t* cap) {
-    if (*cap == 0) *cap = 64;
-    else *cap *= 2;
-    return realloc(p, elem_size * (*cap));
-}
-
-static void kg_init_standalone(KGContext* ctx) {
-    ctx->strings.s = NULL; ctx->strings.n = ctx->strings.cap = 0;
-    ctx->triples.t = NULL; ctx->triples.n = ctx->triples.cap = 0;
-}
-
-static EntityID intern(KGContext* ctx, const char* str) {
-    for (size_t i = 0; i < ctx->strings.n; ++i)
-        if (strcmp(ctx->strings.s[i], str) == 0)
-            return (EntityID)(i + 1);
-    if (ctx->strings.n == ctx->strings.cap)
-        ctx->strings.s = grow(ctx->strings.s, sizeof(char*), &ctx->strings.cap);
-    ctx->strings.s[ctx->strings.n] = strdup(str);
-    return ++ctx->strings.n;
-}
-
-static void add_triple(KGContext* ctx, EntityID s, EntityID p, EntityID o) {
-    if (ctx->triples.n == ctx->triples.cap)
-        ctx->triples.t = grow(ctx->triples.t, sizeof(Triple), &ctx->triples.cap);
-    ctx->triples.t[ctx->triples.n++] = (Triple){s, p, o};
-}
-
-static void kg_free_standalone(KGContext* ctx) {
-    for (size_t i = 0; i < ctx->strings.n; ++i) free(ctx->strings.s[i]);
-    free(ctx->strings.s);
-    free(ctx->triples.t);
-}
-
-static int load_text(KGContext* ctx, const char* path) {
-    FILE* f = fopen(path, "r");
-    if (!f) { perror("fopen"); return -1; }
-
-    EntityID doc      = intern(ctx, "document");
-    EntityID contains = intern(ctx, "contains");
-    EntityID next_to  = intern(ctx, "next-to");
-    EntityID part_of  = intern(ctx, "part-of");
-
-    char* line = NULL; size_t len = 0;
-    int sentence_id = 0;
-
-    while (getline(&line, &len, f) != -1) {
-        char* l = line;
-        while (isspace(*l)) l++;
-        if (*l == '\0' || *l == '#') continue;
-
-        sentence_id++;
-        char sname[32];
-        snprintf(sname, sizeof(sname), "sentence-%d", sentence_id);
-        EntityID sent = intern(ctx, sname);
-        add_triple(ctx, sent, part_of, doc);
-
-        char* tok = strtok(l, " \t\r\n.,!?;:'\"()");
-        EntityID prev = 0;
-        while (tok) {
-            if (strlen(tok) == 0) { tok = strtok(NULL, " \t\r\n.,!?;:'\"()"); continue; }
-            EntityID word = intern(ctx, tok);
-            add_triple(ctx, sent, contains, word);
-            if (prev) add_triple(ctx, prev, next_to, word);
-            prev = word;
-            tok = strtok(NULL, " \t\r\n.,!?;:'\"()");
-        }
-    }
-    free(line); fclose(f);
-    return 0;
-}
-
 static void layout_circle(KGContext* ctx) {
     positions = realloc(positions, ctx->strings.n * sizeof(Vec2));
     float cx = WINDOW_W / 2.0f;
@@ -98,69 +27,110 @@ static void layout_circle(KGContext* ctx) {
 }
 
 int main(int argc, char** argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <textfile>\n", argv[0]);
+    KGContext kg;
+    kg_init(&kg);
+
+    KGExport ex = { NULL, NULL, WINDOW_W, WINDOW_H, NODE_RADIUS,
+                    { 20, 20, 40, 255 }, { 100, 180, 255, 200 }, { 255, 230, 100, 255 } };
+    int headless = 0, stats = 0;
+    int bad = argc < 2;
+    for (int i = 2; i < argc && !bad; ++i) {
+        if (strcmp(argv[i], "--delims") == 0 && i + 1 < argc) kg_set_delims(&kg, argv[++i]);
+        else if (strcmp(argv[i], "--dedup") == 0) kg_set_dedup(&kg, 1);
+        else if (strcmp(argv[i], "--headless") == 0) headless = 1;
+        else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+        else if (strcmp(argv[i], "--positions") == 0 && i + 1 < argc) { ex.positions = argv[++i]; headless = 1; }
+        else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) { ex.image = argv[++i]; headless = 1; }
+        else bad = 1;
+    }
+    if (bad) {
+        fprintf(stderr, "Usage: %s <textfile|graph.kgs> [--delims STR] [--dedup]\n"
+                        "          [--headless]         no window; report phase timings\n"
+                        "          [--positions FILE]   write positions, CSV if FILE ends in .csv (implies --headless)\n"
+                        "          [--image FILE]       render to PNG or PPM by extension (implies --headless)\n"
+                        "          [--stats]            print load and intern counters on exit\n"
+                        "Wheel zooms, left drag pans, 0 resets the view.\n", argv[0]);
         return 1;
     }
 
-    KGContext kg;
-    kg_init_standalone(&kg);
-
-    if (load_text(&kg, argv[1]) != 0) {
-        kg_free_standalone(&kg);
+    double t0 = kg_clock_ms();
+    int rc = kg_is_snapshot(argv[1]) ? kg_open_graph(&kg, argv[1]) : kg_load_text(&kg, argv[1]);
+    if (rc != 0) {
+        kg_free(&kg);
         return 1;
     }
-
+    double t1 = kg_clock_ms();
     layout_circle(&kg);
+    double t2 = kg_clock_ms();
+    const Adjacency* g = kg_freeze(&kg);
+
+    if (headless) {
+        fprintf(stderr, "Load     : %9.1f ms  %zu entities, %zu triples\n", t1 - t0, kg.strings.n, kg.triples.n);
+        fprintf(stderr, "Layout   : %9.1f ms  circle\n", t2 - t1);
+        fprintf(stderr, "Freeze   : %9.1f ms\n", kg_clock_ms() - t2);
+        rc = kg_export(&kg, positions, &ex);
+        free(positions);
+        if (stats) kg_stats_print(&kg.stats);
+        kg_free(&kg);
+        return rc ? 1 : 0;
+    }
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "SDL_Init error: %s\n", SDL_GetError());
-        kg_free_standalone(&kg);
+        kg_free(&kg);
         return 1;
     }
 
     SDL_Window* win = SDL_CreateWindow("Knowledge Graph", 0, 0, WINDOW_W, WINDOW_H, SDL_WINDOW_SHOWN);
-    SDL_Renderer* ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+    SDL_Renderer* ren = win ? SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED) : NULL;
+    KGDraw draw;
+    if (!ren || kg_draw_init(&draw, ren, NODE_RADIUS) != 0) {
+        fprintf(stderr, "SDL error: %s\n", SDL_GetError());
+        if (ren) {
+            kg_draw_free(&draw);
+            SDL_DestroyRenderer(ren);
+        }
+        if (win) SDL_DestroyWindow(win);
+        SDL_Quit();
+        free(positions);
+        kg_free(&kg);
+        return 1;
+    }
+    KGView view = { 0, 0, 1 };
+    KGGrid grid = { 0 };
+    kg_grid_build(&grid, positions, kg.strings.n);
 
-    int running = 1;
+    // The scene never moves, so draw once and then only when the window
+    // needs repainting; in between the loop sleeps in SDL_WaitEvent.
+    int running = 1, dirty = 1;
     while (running) {
         SDL_Event e;
-        while (SDL_PollEvent(&e)) {
+        for (int have = dirty ? SDL_PollEvent(&e) : SDL_WaitEvent(&e); have; have = SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
                 running = 0;
+            else if (e.type == SDL_WINDOWEVENT || kg_view_event(&view, &e))
+                dirty = 1;
         }
+        if (!running || !dirty) continue;
+        dirty = 0;
+        int sw, sh;
+        SDL_GetRendererOutputSize(ren, &sw, &sh);
 
         SDL_SetRenderDrawColor(ren, 20, 20, 40, 255);
         SDL_RenderClear(ren);
 
-        //Draw edges
-        SDL_SetRenderDrawColor(ren, 100, 180, 255, 200);
-        for (size_t i = 0; i < kg.triples.n; ++i) {
-            Triple t = kg.triples.t[i];
-            if (t.s == 0 || t.o == 0) continue;
-            Vec2 a = positions[t.s - 1];
-            Vec2 b = positions[t.o - 1];
-            SDL_RenderDrawLine(ren, (int)a.x, (int)a.y, (int)b.x, (int)b.y);
-        }
-
-        //Draw nodes
-        SDL_SetRenderDrawColor(ren, 255, 230, 100, 255);
-        for (size_t i = 0; i < kg.strings.n; ++i) {
-            Vec2 p = positions[i];
-            for (int dy = -NODE_RADIUS; dy <= NODE_RADIUS; ++dy) {
-                for (int dx = -NODE_RADIUS; dx <= NODE_RADIUS; ++dx) {
-                    if (dx*dx + dy*dy <= NODE_RADIUS*NODE_RADIUS)
-                        SDL_RenderDrawPoint(ren, (int)p.x + dx, (int)p.y + dy);
-                }
-            }
-        }
+        //Draw edges, then nodes
+        kg_draw_scene(&draw, &view, &grid, g, positions, sw, sh,
+                      (SDL_Color){ 100, 180, 255, 200 }, (SDL_Color){ 255, 230, 100, 255 });
 
         SDL_RenderPresent(ren);
-        SDL_Delay(16);
     }
 
+    kg_grid_free(&grid);
+    kg_draw_free(&draw);
     free(positions);
-    kg_free_standalone(&kg);
+    if (stats) kg_stats_print(&kg.stats);
+    kg_free(&kg);
     SDL_DestroyRenderer(ren);
     SDL_DestroyWindow(win);
     SDL_Quit();
@@ -1,212 +1,162 @@
 #include "../include/kg.h"
+#include "../include/kg_layout.h"
+#include "../include/kg_draw.h"
+#include "../include/kg_export.h"
 #include <SDL2/SDL.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <math.h>
 
 #define WINDOW_W  1400
 #define WINDOW_H  900
 #define NODE_R    7
-#define MARGIN    80
-#define ITERATIONS 900
 
-typedef struct { float x, y; } Vec2;
-static Vec2* pos = NULL;
-
-static void* grow(void* p, size_t es, size_t* cap) {
-    if (*cap == 0) *cap = 64; else *cap *= 2;
-    return realloc(p, es * (*cap));
-}
-
-static void kg_init_standalone(KGContext* ctx) {
-    ctx->strings.s = NULL; ctx->strings.n = ctx->strings.cap = 0;
-    ctx->triples.t = NULL; ctx->triples.n = ctx->triples.cap = 0;
-}
-
-static EntityID intern(KGContext* ctx, const char* str) {
-    for (size_t i = 0; i < ctx->strings.n; ++i)
-        if (strcmp(ctx->strings.s[i], str) == 0) return (EntityID)(i + 1);
-    if (ctx->strings.n == ctx->strings.cap)
-        ctx->strings.s = grow(ctx->strings.s, sizeof(char*), &ctx->strings.cap);
-    ctx->strings.s[ctx->strings.n] = strdup(str);
-    return ++ctx->strings.n;
-}
-
-static void add(KGContext* ctx, EntityID s, EntityID p, EntityID o) {
-    if (ctx->triples.n == ctx->triples.cap)
-        ctx->triples.t = grow(ctx->triples.t, sizeof(Triple), &ctx->triples.cap);
-    ctx->triples.t[ctx->triples.n++] = (Triple){s, p, o};
-}
-
-static void kg_free_standalone(KGContext* ctx) {
-    for (size_t i = 0; i < ctx->strings.n; ++i) free(ctx->strings.s[i]);
-    free(ctx->strings.s); free(ctx->triples.t);
-}
-
-static int load_text(KGContext* ctx, const char* path) {
-    FILE* f = fopen(path, "r");
-    if (!f) { perror("fopen"); return -1; }
-
-    EntityID doc      = intern(ctx, "document");
-    EntityID contains = intern(ctx, "contains");
-    EntityID next_to  = intern(ctx, "next-to");
-    EntityID part_of  = intern(ctx, "part-of");
-
-    char* line = NULL; size_t len = 0;
-    int sid = 0;
-
-    while (getline(&line, &len, f) != -1) {
-        char* l = line;
-        while (isspace(*l)) l++;
-        if (*l == '\0' || *l == '#') continue;
-
-        sid++;
-        char name[32];
-        snprintf(name, sizeof(name), "sentence-%d", sid);
-        EntityID sent = intern(ctx, name);
-        add(ctx, sent, part_of, doc);
-
-        char* tok = strtok(l, " \t\r\n.,!?;:'\"()[]");
-        EntityID prev = 0;
-        while (tok) {
-            if (strlen(tok) == 0) { tok = strtok(NULL, " \t\r\n.,!?;:'\"()[]"); continue; }
-            EntityID w = intern(ctx, tok);
-            add(ctx, sent, contains, w);
-            if (prev) add(ctx, prev, next_to, w);
-            prev = w;
-            tok = strtok(NULL, " \t\r\n.,!?;:'\"()[]");
+int main(int argc, char** argv) {
+    KGContext kg;
+    kg_init(&kg);
+    LayoutParams lp;
+    kg_layout_defaults(&lp, WINDOW_W, WINDOW_H);
+
+    KGExport ex = { NULL, NULL, WINDOW_W, WINDOW_H, NODE_R,
+                    { 18, 22, 38, 255 }, { 120, 180, 255, 180 }, { 255, 230, 120, 255 } };
+    int headless = 0, stats = 0;
+    int bad = argc < 2;
+    for (int i = 2; i < argc && !bad; ++i) {
+        if (strcmp(argv[i], "--delims") == 0 && i + 1 < argc) kg_set_delims(&kg, argv[++i]);
+        else if (strcmp(argv[i], "--headless") == 0) headless = 1;
+        else if (strcmp(argv[i], "--stats") == 0) stats = 1;
+        else if (strcmp(argv[i], "--positions") == 0 && i + 1 < argc) { ex.positions = argv[++i]; headless = 1; }
+        else if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) { ex.image = argv[++i]; headless = 1; }
+        else if (strcmp(argv[i], "--dedup") == 0) kg_set_dedup(&kg, 1);
+        else if (strcmp(argv[i], "--theta") == 0 && i + 1 < argc) lp.theta = strtof(argv[++i], NULL);
+        else if (strcmp(argv[i], "--multilevel") == 0) lp.multilevel = 1;
+        else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) lp.tolerance = strtof(argv[++i], NULL);
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            lp.threads = (unsigned)atoi(argv[++i]);
+            kg_set_threads(&kg, lp.threads);
         }
+        else bad = 1;
     }
-    free(line); fclose(f);
-    return 0;
-}
-
-static void fruchterman_reingold(KGContext* kg) {
-    if (kg->strings.n == 0) return;
-
-    pos = realloc(pos, kg->strings.n * sizeof(Vec2));
-    Vec2* disp = calloc(kg->strings.n, sizeof(Vec2));
-
-    // Initial positions
-    for (size_t i = 0; i < kg->strings.n; i++) {
-        pos[i].x = WINDOW_W * 0.5f + (rand() % 300 - 150);
-        pos[i].y = WINDOW_H * 0.5f + (rand() % 300 - 150);
-    }
-
-    float area = WINDOW_W * WINDOW_H;
-    float k = sqrtf(area / (float)kg->strings.n);
-    float temp = fmaxf(WINDOW_W, WINDOW_H) / 10.0f;
-
-    for (int iter = 0; iter < ITERATIONS; iter++) {
-        // Reset
-        for (size_t i = 0; i < kg->strings.n; i++) disp[i] = (Vec2){0};
-
-        // Repulsion
-        for (size_t v = 0; v < kg->strings.n; v++) {
-            for (size_t u = 0; u < kg->strings.n; u++) {
-                if (u == v) continue;
-                float dx = pos[v].x - pos[u].x;
-                float dy = pos[v].y - pos[u].y;
-                float dist = sqrtf(dx*dx + dy*dy) + 0.01f;
-                float force = k*k / dist;
-                disp[v].x += dx/dist * force;
-                disp[v].y += dy/dist * force;
-            }
-        }
-
-        // Attraction
-        for (size_t i = 0; i < kg->triples.n; i++) {
-            EntityID v = kg->triples.t[i].s - 1;
-            EntityID u = kg->triples.t[i].o - 1;
-            float dx = pos[v].x - pos[u].x;
-            float dy = pos[v].y - pos[u].y;
-            float dist = sqrtf(dx*dx + dy*dy) + 0.01f;
-            float force = dist*dist / k;
-            disp[v].x -= dx/dist * force;
-            disp[v].y -= dy/dist * force;
-            disp[u].x += dx/dist * force;
-            disp[u].y += dy/dist * force;
-        }
-
-        // Apply + cool
-        for (size_t v = 0; v < kg->strings.n; v++) {
-            float dlen = sqrtf(disp[v].x*disp[v].x + disp[v].y*disp[v].y);
-            if (dlen > 0) {
-                float limit = fminf(dlen, temp);
-                pos[v].x += disp[v].x / dlen * limit;
-                pos[v].y += disp[v].y / dlen * limit;
-            }
-            pos[v].x = fmaxf(MARGIN, fminf(WINDOW_W - MARGIN, pos[v].x));
-            pos[v].y = fmaxf(MARGIN, fminf(WINDOW_H - MARGIN, pos[v].y));
-        }
-        temp *= 0.95f;
-        if (temp < 1.0f) temp = 1.0f;
+    if (bad) {
+        fprintf(stderr, "Usage: %s <textfile|graph.kgs> [--delims STR] [--dedup] [--threads N]\n"
+                        "          [--theta T]          Barnes-Hut opening angle, 0 = exact (default 0.8)\n"
+                        "          [--tolerance P]      stop once nodes move less than P pixels, 0 = never (default 0.05)\n"
+                        "          [--multilevel]       lay out a coarsened graph first, then refine it\n"
+                        "          [--headless]         no window; run the layout to the end and report phase timings\n"
+                        "          [--positions FILE]   write positions, CSV if FILE ends in .csv (implies --headless)\n"
+                        "          [--image FILE]       render to PNG or PPM by extension (implies --headless)\n"
+                        "          [--stats]            print load, intern and layout counters on exit\n"
+                        "Wheel zooms, left drag pans, 0 resets the view.\n", argv[0]);
+        return 1;
     }
-    free(disp);
-}
-
-int main(int argc, char** argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <textfile>\n", argv[0]);
+    double t0 = kg_clock_ms();
+    int rc = kg_is_snapshot(argv[1]) ? kg_open_graph(&kg, argv[1]) : kg_load_text(&kg, argv[1]);
+    if (rc != 0) {
+        kg_free(&kg);
         return 1;
     }
 
-    KGContext kg;
-    kg_init_standalone(&kg);
-    if (load_text(&kg, argv[1]) != 0) {
-        kg_free_standalone(&kg);
-        return 1;
+    if (headless) {
+        double t1 = kg_clock_ms();
+        kg_freeze(&kg);
+        double t2 = kg_clock_ms();
+        Vec2* pos = malloc((kg.strings.n ? kg.strings.n : 1) * sizeof(Vec2));
+        KGLayoutStatus st;
+        kg_layout_fr(&kg, &lp, pos, &st);
+        double t3 = kg_clock_ms();
+        fprintf(stderr, "Load     : %9.1f ms  %zu entities, %zu triples\n", t1 - t0, kg.strings.n, kg.triples.n);
+        fprintf(stderr, "Freeze   : %9.1f ms\n", t2 - t1);
+        fprintf(stderr, "Layout   : %9.1f ms  %d iterations, %s (%.3f ms/iter)\n", t3 - t2, st.iterations,
+                st.converged ? "converged" : "not converged", st.iterations ? (t3 - t2) / st.iterations : 0.0);
+        rc = kg_export(&kg, pos, &ex);
+        free(pos);
+        if (stats) kg_stats_print(&kg.stats);
+        kg_free(&kg);
+        return rc ? 1 : 0;
     }
 
-    fruchterman_reingold(&kg);
+    // The layout runs on its own thread; frames show whatever it has published.
+    KGLayout* layout = kg_layout_start(&kg, &lp);
+    const Adjacency* g = kg_freeze(&kg);
+    int reported = 0;
 
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "SDL_Init error: %s\n", SDL_GetError());
-        kg_free_standalone(&kg);
+        kg_layout_stop(layout);
+        kg_free(&kg);
         return 1;
     }
 
     SDL_Window* win = SDL_CreateWindow("Knowledge Graph – Fruchterman-Reingold", 0, 0, WINDOW_W, WINDOW_H, SDL_WINDOW_BORDERLESS);
-
-    SDL_Renderer* ren = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
-
-    int running = 1;
+    SDL_Renderer* ren = win ? SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED) : NULL;
+    KGDraw draw;
+    if (!ren || kg_draw_init(&draw, ren, NODE_R) != 0) {
+        fprintf(stderr, "SDL error: %s\n", SDL_GetError());
+        if (ren) {
+            kg_draw_free(&draw);
+            SDL_DestroyRenderer(ren);
+        }
+        if (win) SDL_DestroyWindow(win);
+        SDL_Quit();
+        kg_layout_stop(layout);
+        kg_free(&kg);
+        return 1;
+    }
+    KGView view = { 0, 0, 1 };
+    KGGrid grid = { 0 };
+
+    // Redraw only for a new layout publish or a window event. While the
+    // layout runs the loop wakes at most every 16 ms to look for one;
+    // after that it sleeps until the next event.
+    int running = 1, dirty = 1, live = 1;
+    unsigned shown = 0;
     while (running) {
         SDL_Event e;
-        while (SDL_PollEvent(&e))
+        for (int have = SDL_WaitEventTimeout(&e, dirty ? 0 : live ? 16 : -1); have; have = SDL_PollEvent(&e)) {
             if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE))
                 running = 0;
+            else if (e.type == SDL_WINDOWEVENT || kg_view_event(&view, &e))
+                dirty = 1;
+        }
+        if (!running) break;
+
+        KGLayoutStatus st;
+        unsigned version;
+        const Vec2* pos = kg_layout_acquire(layout, &version, &st);
+        live = !st.done;
+        if (st.done && !reported) {
+            fprintf(stderr, "Layout: %s after %d iterations\n",
+                    st.converged ? "converged" : "stopped", st.iterations);
+            reported = 1;
+        }
+        if (version != shown) {
+            kg_grid_build(&grid, pos, kg.strings.n);
+            shown = version;
+            dirty = 1;
+        }
+        if (!dirty) {
+            kg_layout_release(layout);
+            continue;
+        }
+        dirty = 0;
 
+        int sw, sh;
+        SDL_GetRendererOutputSize(ren, &sw, &sh);
         SDL_SetRenderDrawColor(ren, 18, 22, 38, 255);
         SDL_RenderClear(ren);
-
-        // Edges
-        SDL_SetRenderDrawColor(ren, 120, 180, 255, 180);
-        for (size_t i = 0; i < kg.triples.n; i++) {
-            Triple t = kg.triples.t[i];
-            Vec2 a = pos[t.s - 1];
-            Vec2 b = pos[t.o - 1];
-            SDL_RenderDrawLine(ren, (int)a.x, (int)a.y, (int)b.x, (int)b.y);
-        }
-
-        // Nodes
-        SDL_SetRenderDrawColor(ren, 255, 230, 120, 255);
-        for (size_t i = 0; i < kg.strings.n; i++) {
-            Vec2 p = pos[i];
-            for (int dy = -NODE_R; dy <= NODE_R; dy++)
-                for (int dx = -NODE_R; dx <= NODE_R; dx++)
-                    if (dx*dx + dy*dy <= NODE_R*NODE_R)
-                        SDL_RenderDrawPoint(ren, (int)p.x + dx, (int)p.y + dy);
-        }
+        kg_draw_scene(&draw, &view, &grid, g, pos, sw, sh,
+                      (SDL_Color){ 120, 180, 255, 180 }, (SDL_Color){ 255, 230, 120, 255 });
+        kg_layout_release(layout);
 
         SDL_RenderPresent(ren);
-        SDL_Delay(16);
     }
 
-    free(pos);
-    kg_free_standalone(&kg);
+    kg_grid_free(&grid);
+    kg_draw_free(&draw);
+    kg_layout_stop(layout);
+    if (stats) kg_stats_print(&kg.stats);
+    kg_free(&kg);
     SDL_DestroyRenderer(ren);
     SDL_DestroyWindow(win);
     SDL_Quit();
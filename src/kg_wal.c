@@ -0,0 +1,358 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Log layout: a header naming the snapshot the log extends, then 8-byte
+   aligned records, each: header, uint32 lengths of the strings it adds
+   (in ID order, after the snapshot's and earlier records'), their
+   NUL-separated bytes, its triples in global IDs, then their weights if
+   flagged. Host byte order, like the snapshot. Compaction writes a new
+   snapshot first, so a log left over from a crash names the old one and
+   is discarded. */
+
+static const char LOG_MAGIC[8] = "KGWAL1";
+#define RECORD_MAGIC 0x5257474Bu    /* "KGWR" */
+#define LOG_WEIGHTED 1u
+
+#define SYNC_BYTES (1u << 20)       /* fsync once this much is unsynced */
+#define COMPACT_SHARE 4             /* compact once the log is 1/4 of the snapshot */
+
+typedef struct {
+    char magic[8];
+    uint64_t base;                  /* kg_snapshot_tag of the snapshot */
+} LogHeader;
+
+typedef struct {
+    uint64_t checksum;              /* over the rest of the record */
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t n_strings, pool_size, n_triples;
+    uint64_t sentences;             /* ctx->sentences after this record */
+    uint64_t size;                  /* whole record, this header included */
+} LogRecord;
+
+#define ALIGN8(x) (((x) + 7) & ~(uint64_t)7)
+
+static uint64_t record_size(uint64_t n_strings, uint64_t pool_size, uint64_t n_triples, int weighted) {
+    return sizeof(LogRecord) + ALIGN8(n_strings * sizeof(uint32_t)) + ALIGN8(pool_size) +
+           ALIGN8(n_triples * sizeof(Triple)) + (weighted ? ALIGN8(n_triples * sizeof(uint32_t)) : 0);
+}
+
+typedef struct {
+    const LogRecord* h;
+    const uint32_t* len;
+    const char* pool;
+    const Triple* t;
+    const uint32_t* w;              /* NULL: all 1 */
+} Record;
+
+typedef struct {
+    char* map;
+    size_t size;
+} Log;
+
+/* Maps the log at path. Returns 0 unless it exists and extends the
+   snapshot tagged base. */
+static int map_log(const char* path, uint64_t base, Log* lg) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+    struct stat sb;
+    lg->map = NULL;
+    if (fstat(fd, &sb) == 0 && (size_t)sb.st_size >= sizeof(LogHeader)) {
+        lg->size = (size_t)sb.st_size;
+        lg->map = mmap(NULL, lg->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (lg->map == MAP_FAILED) lg->map = NULL;
+    }
+    close(fd);
+    if (!lg->map) return 0;
+    const LogHeader* h = (const LogHeader*)lg->map;
+    if (memcmp(h->magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || h->base != base) {
+        munmap(lg->map, lg->size);
+        return 0;
+    }
+    return 1;
+}
+
+/* Reads the record at *at and moves past it; 0 at the end of the log or
+   at a torn or corrupt record. */
+static int next_record(const Log* lg, uint64_t* at, Record* r) {
+    uint64_t left = lg->size - *at;
+    const char* p = lg->map + *at;
+    const LogRecord* h = (const LogRecord*)p;
+    if (left < sizeof(LogRecord) || h->magic != RECORD_MAGIC || h->size > left ||
+        h->n_strings > left / sizeof(uint32_t) || h->pool_size > left ||
+        h->n_triples > left / sizeof(Triple) ||
+        h->size != record_size(h->n_strings, h->pool_size, h->n_triples, h->flags & LOG_WEIGHTED) ||
+        kg_checksum(p + sizeof(h->checksum), h->size - sizeof(h->checksum)) != h->checksum)
+        return 0;
+
+    r->h = h;
+    r->len = (const uint32_t*)(p + sizeof(LogRecord));
+    r->pool = (const char*)r->len + ALIGN8(h->n_strings * sizeof(uint32_t));
+    r->t = (const Triple*)(r->pool + ALIGN8(h->pool_size));
+    r->w = h->flags & LOG_WEIGHTED ? (const uint32_t*)((const char*)r->t + ALIGN8(h->n_triples * sizeof(Triple))) : NULL;
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < h->n_strings && used <= h->pool_size; ++i) used += r->len[i] + 1ULL;
+    if (used != h->pool_size) return 0;
+    *at += h->size;
+    return 1;
+}
+
+static int log_name(const char* path, char* out, size_t n) {
+    return snprintf(out, n, "%s.wal", path) < (int)n ? 0 : -1;
+}
+
+/* Replay */
+
+static int replay(KGContext* ctx, const Record* r) {
+    const char* s = r->pool;
+    for (uint64_t i = 0; i < r->h->n_strings; s += r->len[i++] + 1) {
+        size_t before = ctx->strings.n;
+        kg_intern_n(ctx, s, r->len[i]);
+        if (ctx->strings.n == before) return -1;
+    }
+    size_t n = ctx->strings.n;
+    for (uint64_t i = 0; i < r->h->n_triples; ++i) {
+        Triple t = r->t[i];
+        if (!t.s || !t.p || !t.o || t.s > n || t.p > n || t.o > n) return -1;
+        kg_add_weighted(ctx, t.s, t.p, t.o, r->w ? r->w[i] : 1);
+    }
+    ctx->sentences = r->h->sentences;
+    return 0;
+}
+
+int kg_open_graph(KGContext* ctx, const char* path) {
+    char log_path[4096];
+    Log lg;
+    if (kg_open_mmap(ctx, path) != 0) return -1;
+    if (log_name(path, log_path, sizeof(log_path)) != 0 || !map_log(log_path, kg_snapshot_tag(ctx), &lg))
+        return 0;
+
+    double t0 = KG_CLOCK();
+    // Size the store for every record first; this is also the only copy
+    // out of the mapping.
+    size_t strings = ctx->strings.n, pool = ctx->strings.pool_n, triples = ctx->triples.n;
+    uint64_t at = sizeof(LogHeader);
+    Record r;
+    while (next_record(&lg, &at, &r)) {
+        strings += r.h->n_strings;
+        pool += r.h->pool_size;
+        triples += r.h->n_triples;
+    }
+    if (at > sizeof(LogHeader)) kg_reserve(ctx, strings, pool, triples);
+
+    int err = 0;
+    at = sizeof(LogHeader);
+    while (!err && next_record(&lg, &at, &r)) err = replay(ctx, &r);
+    munmap(lg.map, lg.size);
+    if (err) fprintf(stderr, "%s: log does not match its snapshot\n", log_path);
+    KG_PHASE(ctx, KG_PHASE_LOAD, t0);
+    return err ? -1 : 0;
+}
+
+/* Appending */
+
+struct KGWal {
+    KGContext* ctx;         /* settings and stats */
+    char path[4096], log_path[4096];
+    KGContext base;         /* the snapshot, mapped read-only */
+    KGContext added;        /* strings the log adds; ID i here is base.strings.n + i */
+    size_t sentences;
+    FILE* log;
+    uint64_t log_size, unsynced;
+    int failed;             /* a record may be half written: refuse more */
+};
+
+static int write_log_header(KGWal* w) {
+    LogHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LOG_MAGIC, sizeof(h.magic));
+    h.base = kg_snapshot_tag(&w->base);
+    w->log_size = sizeof(h);
+    return fwrite(&h, sizeof(h), 1, w->log) != 1 || fflush(w->log) != 0 || fsync(fileno(w->log)) != 0;
+}
+
+/* Maps the snapshot and picks up the strings and sentence count of its
+   log, cutting off a torn tail; a missing or stale log is started anew. */
+static int attach(KGWal* w) {
+    kg_init(&w->base);
+    kg_init(&w->added);
+    if (kg_open_mmap(&w->base, w->path) != 0) return -1;
+    w->sentences = w->base.sentences;
+
+    Log lg;
+    uint64_t end = 0;
+    if (map_log(w->log_path, kg_snapshot_tag(&w->base), &lg)) {
+        Record r;
+        end = sizeof(LogHeader);
+        while (next_record(&lg, &end, &r)) {
+            const char* s = r.pool;
+            for (uint64_t i = 0; i < r.h->n_strings; s += r.len[i++] + 1) kg_intern_n(&w->added, s, r.len[i]);
+            w->sentences = r.h->sentences;
+        }
+        munmap(lg.map, lg.size);
+    }
+
+    int err;
+    if (end) {
+        err = truncate(w->log_path, (off_t)end) != 0 || !(w->log = fopen(w->log_path, "ab"));
+        w->log_size = end;
+    } else {
+        err = !(w->log = fopen(w->log_path, "wb")) || write_log_header(w);
+    }
+    w->unsynced = 0;
+    if (err) perror(w->log_path);
+    return err ? -1 : 0;
+}
+
+static void release(KGWal* w) {
+    if (w->log) fclose(w->log);
+    w->log = NULL;
+    kg_free(&w->base);
+    kg_free(&w->added);
+}
+
+KGWal* kg_wal_open(KGContext* ctx, const char* path) {
+    if (ctx->cooc.window) {
+        fprintf(stderr, "%s: co-occurrence edges need the whole text in one load, not appends\n", path);
+        return NULL;
+    }
+    KGWal* w = calloc(1, sizeof(KGWal));
+    w->ctx = ctx;
+    int err = snprintf(w->path, sizeof(w->path), "%s", path) >= (int)sizeof(w->path) ||
+              log_name(path, w->log_path, sizeof(w->log_path)) != 0;
+    if (!err && access(path, F_OK) != 0) {
+        KGContext empty;
+        kg_init(&empty);
+        kg_set_dedup(&empty, ctx->triples.dedup);
+        err = kg_save(&empty, path) != 0;
+        kg_free(&empty);
+    }
+    if (err || attach(w) != 0) {
+        release(w);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+int kg_wal_sync(KGWal* w) {
+    if (fflush(w->log) != 0 || fsync(fileno(w->log)) != 0) {
+        perror(w->log_path);
+        return -1;
+    }
+    KG_STAT(w->ctx, wal_syncs, 1);
+    w->unsynced = 0;
+    return 0;
+}
+
+/* Builds the record for doc, whose strings are mapped to global IDs by
+   remap and whose new strings are added's from first on. */
+static char* make_record(const KGWal* w, const KGContext* doc, const EntityID* remap, size_t first, uint64_t* size) {
+    const StringTable* st = &w->added.strings;
+    size_t n_strings = st->n - first;
+    size_t pool_size = n_strings ? st->pool_n - st->off[first] : 0;
+    size_t n_triples = doc->triples.n;
+    int weighted = doc->triples.w != NULL;
+    *size = record_size(n_strings, pool_size, n_triples, weighted);
+
+    char* rec = calloc(1, *size);
+    LogRecord* h = (LogRecord*)rec;
+    h->magic = RECORD_MAGIC;
+    h->flags = weighted ? LOG_WEIGHTED : 0;
+    h->n_strings = n_strings;
+    h->pool_size = pool_size;
+    h->n_triples = n_triples;
+    h->sentences = doc->sentences;
+    h->size = *size;
+
+    char* p = rec + sizeof(LogRecord);
+    if (n_strings) memcpy(p, st->len + first, n_strings * sizeof(uint32_t));
+    p += ALIGN8(n_strings * sizeof(uint32_t));
+    if (pool_size) memcpy(p, st->pool + st->off[first], pool_size);
+    p += ALIGN8(pool_size);
+    Triple* t = (Triple*)p;
+    for (size_t i = 0; i < n_triples; ++i) {
+        Triple d = doc->triples.t[i];
+        t[i] = (Triple){ remap[d.s], remap[d.p], remap[d.o] };
+    }
+    p += ALIGN8(n_triples * sizeof(Triple));
+    if (weighted) memcpy(p, doc->triples.w, n_triples * sizeof(uint32_t));
+    h->checksum = kg_checksum(rec + sizeof(h->checksum), *size - sizeof(h->checksum));
+    return rec;
+}
+
+int kg_wal_append_text(KGWal* w, const char* path) {
+    if (w->failed) return -1;
+    KGContext doc;
+    kg_init(&doc);
+    memcpy(doc.delims, w->ctx->delims, sizeof(doc.delims));
+    doc.threads = w->ctx->threads;
+    doc.sentences = w->sentences;
+    kg_set_dedup(&doc, w->ctx->triples.dedup);
+    if (kg_load_text(&doc, path) != 0) {
+        kg_free(&doc);
+        return -1;
+    }
+
+    // Strings the snapshot lacks take the next IDs after the log's.
+    size_t base_n = w->base.strings.n, first = w->added.strings.n;
+    EntityID* remap = malloc((doc.strings.n + 1) * sizeof(EntityID));
+    remap[0] = INVALID_ID;
+    for (size_t i = 0; i < doc.strings.n; ++i) {
+        const char* s = doc.strings.pool + doc.strings.off[i];
+        EntityID id = kg_lookup_n(&w->base, s, doc.strings.len[i]);
+        remap[i + 1] = id != INVALID_ID ? id : (EntityID)(base_n + kg_intern_n(&w->added, s, doc.strings.len[i]));
+    }
+
+    uint64_t size;
+    char* rec = make_record(w, &doc, remap, first, &size);
+    int err = fwrite(rec, 1, size, w->log) != size;
+    free(rec);
+    free(remap);
+    if (err) {
+        perror(w->log_path);
+        w->failed = 1;
+    } else {
+        w->sentences = doc.sentences;
+        w->log_size += size;
+        w->unsynced += size;
+        KG_STAT(w->ctx, wal_records, 1);
+        KG_STAT(w->ctx, wal_bytes, size);
+    }
+    kg_stats_add(&w->ctx->stats, &doc.stats);
+    kg_free(&doc);
+
+    if (!err && w->unsynced >= SYNC_BYTES) err = kg_wal_sync(w);
+    if (!err && w->log_size * COMPACT_SHARE > w->base.map_size) err = kg_wal_compact(w);
+    return err ? -1 : 0;
+}
+
+int kg_wal_compact(KGWal* w) {
+    if (w->failed || kg_wal_sync(w) != 0) return -1;
+    KGContext g;
+    kg_init(&g);
+    int err = kg_open_graph(&g, w->path) != 0 || kg_save(&g, w->path) != 0;
+    kg_free(&g);
+    if (err) return -1;
+    // The new snapshot has a new tag, so the old log is stale from here on.
+    release(w);
+    KG_STAT(w->ctx, compactions, 1);
+    if (attach(w) != 0) {
+        w->failed = 1;
+        return -1;
+    }
+    return 0;
+}
+
+int kg_wal_close(KGWal* w) {
+    int err = !w->log || w->failed || kg_wal_sync(w) != 0;
+    release(w);
+    free(w);
+    return err ? -1 : 0;
+}
@@ -0,0 +1,521 @@
+#include "../include/kg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Walks run over a compact copy of the CSR holding only the edges they
+   may follow: each node's neighbours in one run, plus a Vose alias table
+   per node when edges are weighted. For node2vec, which tests adjacency,
+   runs are sorted by ID and repeated neighbours folded into weights.
+   A step is then two or three array reads.
+   Workers advance a chunk of walks in lockstep, picking every walk's
+   slot in one pass and reading it in the next, so the misses of a whole
+   chunk are in flight together. Walk i depends only on the seed and i. */
+
+#define CHUNK 256               /* walks per claim, advanced in lockstep */
+#define BUILD_CHUNK 4096        /* nodes per claim while building */
+#define HEADER 24
+
+static const char WALK_MAGIC[8] = { 'K', 'G', 'W', 'A', 'L', 'K', '1', 0 };
+
+typedef struct {
+    float prob;                 /* keep the slot's own neighbour below this */
+    EntityID alt;               /* the neighbour otherwise */
+} Alias;
+
+typedef struct Walker Walker;
+
+typedef struct {
+    Walker* W;
+    uint64_t rng[4];
+    EntityID* buf;              /* the chunk's walks, row by row */
+    EntityID* cur;
+    EntityID* prev;
+    size_t* slot;
+    uint32_t* live;             /* walks of the chunk not at a dead end */
+    double* q;                  /* alias build scratch */
+    uint32_t* stack;
+    size_t scratch_cap;
+    uint64_t steps, rejects;
+} Worker;
+
+enum { PHASE_GATHER, PHASE_PACK, PHASE_WALK };
+
+struct Walker {
+    const Adjacency* g;
+    const KGWalkParams* wp;
+    const uint64_t* want;       /* predicate bitset, NULL for all */
+    size_t n;
+    size_t* off;                /* n + 1: each node's run of followable edges */
+    uint64_t* edge;             /* while building: neighbour << 32 | weight */
+    size_t* edge_off;           /* while building: each node's run in edge */
+    EntityID* nbr;
+    Alias* alias;               /* NULL when every weight is 1 */
+    uint64_t* cum;              /* weights summed over each node's edges so far,
+                                   only for fold with alias */
+    int sorted;
+    float hi;                   /* rejection envelope: max(1, 1/q) */
+    float lo;                   /* smallest bias, accepted without a test */
+    float back;                 /* bias of going back, capped at hi */
+    float fold;                 /* 1/p beyond hi, sampled on its own */
+    EntityID* start;            /* nodes with an edge to follow */
+    size_t n_start, n_walks;
+    int fd;
+    int err;
+
+    int phase;
+    size_t work, next;
+    Worker* workers;
+    unsigned helpers, busy, gen;
+    int quit;
+    pthread_t* tid;
+    pthread_mutex_t mu;
+    pthread_cond_t go, idle;
+};
+
+void kg_walk_defaults(KGWalkParams* wp) {
+    wp->length = 80;
+    wp->per_node = 10;
+    wp->p = wp->q = 1.0;
+    wp->preds = NULL;
+    wp->n_preds = 0;
+    wp->dir = KG_BOTH;
+    wp->seed = 1;
+}
+
+/* xoshiro256**, seeded through splitmix64. */
+static inline uint64_t rotl(uint64_t x, int k) { return x << k | x >> (64 - k); }
+
+static inline uint64_t next_u64(uint64_t* s) {
+    uint64_t r = rotl(s[1] * 5, 7) * 9, t = s[1] << 17;
+    s[2] ^= s[0]; s[3] ^= s[1]; s[1] ^= s[2]; s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return r;
+}
+
+static void seed_rng(uint64_t* s, uint64_t seed) {
+    for (int i = 0; i < 4; ++i) {
+        uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        s[i] = z ^ (z >> 31);
+    }
+}
+
+static inline size_t below(uint64_t* s, size_t n) {
+    uint64_t r = next_u64(s);
+    return n <= UINT32_MAX ? (size_t)(((r >> 32) * n) >> 32) : (size_t)(r % n);
+}
+
+static inline float unit(uint64_t* s) {
+    return (float)(next_u64(s) >> 40) * 0x1p-24f;
+}
+
+/* Building */
+
+static inline int wanted(const Walker* W, EntityID p) {
+    return !W->want || (p < W->n && (W->want[p >> 6] >> (p & 63) & 1));
+}
+
+static size_t count_edges(const Walker* W, EntityID v) {
+    const Adjacency* g = W->g;
+    size_t deg = 0;
+    if (W->wp->dir & KG_OUT)
+        for (size_t e = g->out_off[v]; e < g->out_off[v + 1]; ++e) deg += wanted(W, g->out_pred[e]);
+    if (W->wp->dir & KG_IN)
+        for (size_t e = g->in_off[v]; e < g->in_off[v + 1]; ++e) deg += wanted(W, g->in_pred[e]);
+    return deg;
+}
+
+static int by_edge(const void* x, const void* y) {
+    uint64_t a = *(const uint64_t*)x, b = *(const uint64_t*)y;
+    return a < b ? -1 : a > b;
+}
+
+/* Vose's method over the weights of edges src[0..deg), whose row starts at lo. */
+static void build_alias(Worker* k, const uint64_t* src, size_t lo, size_t deg) {
+    Walker* W = k->W;
+    if (deg > k->scratch_cap) {
+        k->scratch_cap = deg;
+        k->q = realloc(k->q, deg * sizeof(double));
+        k->stack = realloc(k->stack, deg * sizeof(uint32_t));
+    }
+    double sum = 0;
+    for (size_t i = 0; i < deg; ++i) sum += (uint32_t)src[i];
+    size_t small = 0, large = deg;          // small grows up, large down
+    for (size_t i = 0; i < deg; ++i) {
+        k->q[i] = (uint32_t)src[i] * (double)deg / sum;
+        if (k->q[i] < 1.0) k->stack[small++] = (uint32_t)i;
+        else k->stack[--large] = (uint32_t)i;
+    }
+    Alias* a = W->alias + lo;
+    for (size_t i = 0; i < deg; ++i) a[i] = (Alias){ 1.0f, W->nbr[lo + i] };
+    while (small > 0 && large < deg) {
+        uint32_t s = k->stack[--small], l = k->stack[large++];
+        a[s] = (Alias){ (float)k->q[s], W->nbr[lo + l] };
+        k->q[l] -= 1.0 - k->q[s];
+        if (k->q[l] < 1.0) k->stack[small++] = l;
+        else k->stack[--large] = l;
+    }
+}
+
+/* Gathers each node's followable edges into its run of edge[]. For
+   node2vec the run is sorted and repeats are folded into one weighted
+   edge, which keeps adjacency tests on hub rows short; off[v] is left
+   holding the run's final length. */
+static void gather(Worker* k, size_t lo, size_t hi) {
+    Walker* W = k->W;
+    const Adjacency* g = W->g;
+    for (size_t v = lo; v < hi; ++v) {
+        uint64_t* run = W->edge + W->edge_off[v];
+        size_t j = 0;
+        if (W->wp->dir & KG_OUT)
+            for (size_t e = g->out_off[v]; e < g->out_off[v + 1]; ++e)
+                if (wanted(W, g->out_pred[e])) run[j++] = (uint64_t)g->out_nbr[e] << 32 | (g->out_w ? g->out_w[e] : 1);
+        if (W->wp->dir & KG_IN)
+            for (size_t e = g->in_off[v]; e < g->in_off[v + 1]; ++e)
+                if (wanted(W, g->in_pred[e])) run[j++] = (uint64_t)g->in_nbr[e] << 32 | (g->in_w ? g->in_w[e] : 1);
+        if (W->sorted && j > 1) {
+            qsort(run, j, sizeof(uint64_t), by_edge);
+            size_t d = 0;
+            for (size_t e = 1; e < j; ++e) {
+                if (run[e] >> 32 != run[d] >> 32) { run[++d] = run[e]; continue; }
+                uint64_t w = (uint32_t)run[d] + (uint64_t)(uint32_t)run[e];
+                run[d] = run[d] >> 32 << 32 | (w > UINT32_MAX ? UINT32_MAX : w);
+            }
+            j = d + 1;
+        }
+        W->off[v] = j;
+    }
+}
+
+/* Copies each gathered run to its final place, with its alias table. */
+static void pack(Worker* k, size_t lo, size_t hi) {
+    Walker* W = k->W;
+    for (size_t v = lo; v < hi; ++v) {
+        const uint64_t* run = W->edge + W->edge_off[v];
+        size_t at = W->off[v], deg = W->off[v + 1] - at;
+        for (size_t e = 0; e < deg; ++e) W->nbr[at + e] = (EntityID)(run[e] >> 32);
+        if (W->alias) build_alias(k, run, at, deg);
+        uint64_t sum = 0;
+        if (W->cum)
+            for (size_t e = 0; e < deg; ++e) W->cum[at + e] = sum += (uint32_t)run[e];
+    }
+}
+
+/* Walking */
+
+/* First edge of u to a neighbour >= x. */
+static size_t lower(const Walker* W, EntityID u, EntityID x) {
+    size_t lo = W->off[u], hi = W->off[u + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (W->nbr[mid] < x) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* Edges are followed both ways or only one; both ways the test can
+   search whichever row is shorter. */
+static int has_edge(const Walker* W, EntityID u, EntityID x) {
+    if (W->wp->dir == KG_BOTH && W->off[x + 1] - W->off[x] < W->off[u + 1] - W->off[u]) {
+        EntityID t = u; u = x; x = t;
+    }
+    size_t e = lower(W, u, x);
+    return e < W->off[u + 1] && W->nbr[e] == x;
+}
+
+static inline EntityID resolve(const Walker* W, uint64_t* rng, size_t slot) {
+    if (!W->alias) return W->nbr[slot];
+    Alias a = W->alias[slot];
+    return unit(rng) < a.prob ? W->nbr[slot] : a.alt;
+}
+
+/* node2vec step from v, having come from prev, given a first-order pick
+   x: going back is weighted 1/p, staying next to prev 1, moving away 1/q.
+   Picks are kept with probability bias / hi. A return bias above hi is
+   folded out (as in KnightKing): the excess mass of the edges back to
+   prev is drawn directly, so a small p does not inflate the envelope
+   and with it the rejections. */
+static EntityID biased(Worker* k, EntityID v, EntityID prev, EntityID x) {
+    const Walker* W = k->W;
+    uint64_t* rng = k->rng;
+    size_t lo = W->off[v], deg = W->off[v + 1] - lo;
+    float extra = 0, all = 1;
+    if (W->fold > 0) {
+        // Rows are sorted with repeats folded: prev is at most one edge.
+        size_t e = lower(W, v, prev);
+        uint64_t w = e < lo + deg && W->nbr[e] == prev ? W->cum[e] - (e > lo ? W->cum[e - 1] : 0) : 0;
+        extra = (float)(W->fold * (double)w);
+        all = (float)(W->hi * (double)W->cum[lo + deg - 1]) + extra;
+    }
+    for (;;) {
+        if (extra > 0 && unit(rng) * all < extra) return prev;
+        float u = unit(rng) * W->hi;
+        if (u < W->lo) return x;
+        float bias = x == prev ? W->back : has_edge(W, prev, x) ? 1.0f : (float)(1.0 / W->wp->q);
+        if (u < bias) return x;
+        k->rejects++;
+        x = resolve(W, rng, lo + below(rng, deg));
+    }
+}
+
+static int write_at(int fd, const void* p, size_t n, uint64_t at) {
+    const char* b = p;
+    while (n > 0) {
+        ssize_t r = pwrite(fd, b, n, (off_t)at);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        b += r;
+        n -= (size_t)r;
+        at += (uint64_t)r;
+    }
+    return 0;
+}
+
+static void walk_chunk(Worker* k, size_t c) {
+    Walker* W = k->W;
+    unsigned len = W->wp->length;
+    int bias = W->sorted;
+    size_t first = c * CHUNK;
+    size_t nw = W->n_walks - first < CHUNK ? W->n_walks - first : CHUNK;
+    uint64_t* rng = k->rng;
+    seed_rng(rng, W->wp->seed ^ (c * 0xD1B54A32D192ED03ULL));
+    memset(k->buf, 0, nw * len * sizeof(EntityID));
+
+    size_t live = nw;
+    for (size_t i = 0; i < nw; ++i) {
+        k->cur[i] = k->buf[i * len] = W->start[(first + i) % W->n_start];
+        k->prev[i] = INVALID_ID;
+        k->live[i] = (uint32_t)i;
+    }
+    for (unsigned step = 1; step < len && live; ++step) {
+        // Pick a slot for every walk; a dead end leaves the walk padded.
+        for (size_t j = 0; j < live; ) {
+            uint32_t i = k->live[j];
+            size_t lo = W->off[k->cur[i]], deg = W->off[k->cur[i] + 1] - lo;
+            if (!deg) { k->live[j] = k->live[--live]; continue; }
+            k->slot[i] = lo + below(rng, deg);
+            __builtin_prefetch(&W->nbr[k->slot[i]]);
+            if (W->alias) __builtin_prefetch(&W->alias[k->slot[i]]);
+            j++;
+        }
+        // Read them, resampling what the bias rejects.
+        for (size_t j = 0; j < live; ++j) {
+            uint32_t i = k->live[j];
+            EntityID v = k->cur[i], x = resolve(W, rng, k->slot[i]);
+            if (bias && k->prev[i] != INVALID_ID) x = biased(k, v, k->prev[i], x);
+            k->buf[i * len + step] = x;
+            k->prev[i] = v;
+            k->cur[i] = x;
+            __builtin_prefetch(&W->off[x]);
+            k->steps++;
+        }
+    }
+    if (write_at(W->fd, k->buf, nw * len * sizeof(EntityID), HEADER + (uint64_t)first * len * sizeof(EntityID)) != 0)
+        __atomic_store_n(&W->err, errno ? errno : EIO, __ATOMIC_RELAXED);
+}
+
+/* Thread pool, as in the layout: helpers sleep between phases. */
+
+static void run_share(Worker* k) {
+    Walker* W = k->W;
+    size_t step = W->phase == PHASE_WALK ? 1 : BUILD_CHUNK;
+    for (;;) {
+        size_t lo = __atomic_fetch_add(&W->next, step, __ATOMIC_RELAXED);
+        if (lo >= W->work) return;
+        size_t hi = lo + step < W->work ? lo + step : W->work;
+        if (W->phase == PHASE_GATHER) gather(k, lo, hi);
+        else if (W->phase == PHASE_PACK) pack(k, lo, hi);
+        else if (!__atomic_load_n(&W->err, __ATOMIC_RELAXED)) walk_chunk(k, lo);
+    }
+}
+
+static void* helper(void* arg) {
+    Worker* k = arg;
+    Walker* W = k->W;
+    unsigned seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&W->mu);
+        while (W->gen == seen && !W->quit) pthread_cond_wait(&W->go, &W->mu);
+        seen = W->gen;
+        int quit = W->quit;
+        pthread_mutex_unlock(&W->mu);
+        if (quit) return NULL;
+
+        run_share(k);
+
+        pthread_mutex_lock(&W->mu);
+        if (--W->busy == 0) pthread_cond_signal(&W->idle);
+        pthread_mutex_unlock(&W->mu);
+    }
+}
+
+static void run_phase(Walker* W, int phase, size_t work) {
+    W->phase = phase;
+    W->work = work;
+    W->next = 0;
+    if (W->helpers) {
+        pthread_mutex_lock(&W->mu);
+        W->busy = W->helpers;
+        W->gen++;
+        pthread_cond_broadcast(&W->go);
+        pthread_mutex_unlock(&W->mu);
+    }
+    run_share(&W->workers[0]);
+    if (W->helpers) {
+        pthread_mutex_lock(&W->mu);
+        while (W->busy) pthread_cond_wait(&W->idle, &W->mu);
+        pthread_mutex_unlock(&W->mu);
+    }
+}
+
+static void start_helpers(Walker* W, unsigned threads) {
+    pthread_mutex_init(&W->mu, NULL);
+    pthread_cond_init(&W->go, NULL);
+    pthread_cond_init(&W->idle, NULL);
+    W->workers = calloc(threads, sizeof(Worker));
+    W->tid = malloc(threads * sizeof(pthread_t));
+    for (unsigned i = 0; i < threads; ++i) W->workers[i].W = W;
+    for (unsigned i = 1; i < threads; ++i) {
+        if (pthread_create(&W->tid[W->helpers], NULL, helper, &W->workers[i]) != 0) break;
+        W->helpers++;
+    }
+}
+
+static void stop_helpers(Walker* W) {
+    pthread_mutex_lock(&W->mu);
+    W->quit = 1;
+    pthread_cond_broadcast(&W->go);
+    pthread_mutex_unlock(&W->mu);
+    for (unsigned i = 0; i < W->helpers; ++i) pthread_join(W->tid[i], NULL);
+    free(W->tid);
+    pthread_cond_destroy(&W->idle);
+    pthread_cond_destroy(&W->go);
+    pthread_mutex_destroy(&W->mu);
+}
+
+/* Builds the walk graph and the list of start nodes. */
+static void build(Walker* W) {
+    const Adjacency* g = W->g;
+    W->edge_off = malloc((W->n + 1) * sizeof(size_t));
+    W->off = malloc((W->n + 1) * sizeof(size_t));
+    W->start = malloc((W->n ? W->n : 1) * sizeof(EntityID));
+    size_t m = 0;
+    for (size_t v = 0; v < W->n; ++v) {
+        W->edge_off[v] = m;
+        size_t deg = v ? count_edges(W, (EntityID)v) : 0;
+        if (deg) W->start[W->n_start++] = (EntityID)v;
+        m += deg;
+    }
+    W->edge = malloc((m ? m : 1) * sizeof(uint64_t));
+    run_phase(W, PHASE_GATHER, W->n);
+
+    m = 0;
+    for (size_t v = 0; v < W->n; ++v) {
+        size_t deg = W->off[v];
+        W->off[v] = m;
+        m += deg;
+    }
+    W->off[W->n] = m;
+    W->nbr = malloc((m ? m : 1) * sizeof(EntityID));
+    // Folded repeats carry weights even in an unweighted graph.
+    if (W->sorted || (W->wp->dir & KG_OUT && g->out_w) || (W->wp->dir & KG_IN && g->in_w)) {
+        W->alias = malloc((m ? m : 1) * sizeof(Alias));
+        if (W->fold > 0) W->cum = malloc((m ? m : 1) * sizeof(uint64_t));
+    }
+    run_phase(W, PHASE_PACK, W->n);
+    free(W->edge);
+    free(W->edge_off);
+    W->edge = NULL;
+}
+
+int kg_walk_file(KGContext* ctx, const KGWalkParams* wp, const char* path, size_t* walks) {
+    double t0 = KG_CLOCK();
+    if (walks) *walks = 0;
+    if (wp->length == 0 || !(wp->p > 0) || !(wp->q > 0)) {
+        fprintf(stderr, "kg_walk: length, p and q must be positive\n");
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror(path); return -1; }
+
+    Walker W;
+    memset(&W, 0, sizeof(W));
+    W.g = kg_freeze(ctx);
+    W.wp = wp;
+    W.n = W.g->n;
+    W.fd = fd;
+    W.sorted = wp->p != 1.0 || wp->q != 1.0;
+    double hi = 1.0 / wp->q > 1.0 ? 1.0 / wp->q : 1.0, lo = 1.0 / wp->q < 1.0 ? 1.0 / wp->q : 1.0;
+    W.hi = (float)hi;
+    W.lo = (float)(1.0 / wp->p < lo ? 1.0 / wp->p : lo);
+    W.back = (float)(1.0 / wp->p < hi ? 1.0 / wp->p : hi);
+    W.fold = (float)(1.0 / wp->p > hi ? 1.0 / wp->p - hi : 0.0);
+    uint64_t* want = NULL;
+    if (wp->preds) {
+        want = calloc((W.n + 63) / 64 + 1, sizeof(uint64_t));
+        for (size_t i = 0; i < wp->n_preds; ++i)
+            if (wp->preds[i] < W.n) want[wp->preds[i] >> 6] |= 1ULL << (wp->preds[i] & 63);
+        W.want = want;
+    }
+
+    unsigned threads = ctx->threads ? ctx->threads : 1;
+    start_helpers(&W, threads);
+    build(&W);
+    W.n_walks = W.n_start * wp->per_node;
+    for (unsigned i = 0; i < threads; ++i) {
+        Worker* k = &W.workers[i];
+        k->buf = malloc((size_t)CHUNK * wp->length * sizeof(EntityID));
+        k->cur = malloc(CHUNK * sizeof(EntityID));
+        k->prev = malloc(CHUNK * sizeof(EntityID));
+        k->slot = malloc(CHUNK * sizeof(size_t));
+        k->live = malloc(CHUNK * sizeof(uint32_t));
+    }
+
+    struct {
+        char magic[8];
+        uint64_t n_walks;
+        uint32_t length, flags;
+    } h;
+    memcpy(h.magic, WALK_MAGIC, sizeof(h.magic));
+    h.n_walks = W.n_walks;
+    h.length = wp->length;
+    h.flags = 0;
+    if (write_at(fd, &h, sizeof(h), 0) != 0) W.err = errno;
+    else run_phase(&W, PHASE_WALK, (W.n_walks + CHUNK - 1) / CHUNK);
+    stop_helpers(&W);
+
+    uint64_t steps = 0, rejects = 0;
+    for (unsigned i = 0; i < threads; ++i) {
+        Worker* k = &W.workers[i];
+        steps += k->steps;
+        rejects += k->rejects;
+        free(k->buf); free(k->cur); free(k->prev); free(k->slot); free(k->live);
+        free(k->q); free(k->stack);
+    }
+    free(W.workers);
+    free(W.off); free(W.nbr); free(W.alias); free(W.cum); free(W.start);
+    free(want);
+
+    int err = W.err;
+    if (close(fd) != 0 && !err) err = errno;
+    if (err) {
+        errno = err;
+        perror(path);
+        return -1;
+    }
+    if (walks) *walks = W.n_walks;
+    KG_STAT(ctx, walks, W.n_walks);
+    KG_STAT(ctx, walk_steps, steps);
+    KG_STAT(ctx, walk_rejects, rejects);
+    KG_PHASE(ctx, KG_PHASE_WALK, t0);
+    return 0;
+}